@@ -17,125 +17,146 @@
 
 #include "Heap.h"
 #include <cstdlib>
+#include <cmath>
 
 
+// the entries a heap starts with
+#define HEAP_CAPACITY 1024
+
 Heap::Heap(Data *data)
 {
 	size = -1;
-	heap = data->heap;
+	capacity = HEAP_CAPACITY;
+	heap = (HeapItem *) malloc(sizeof(HeapItem) * capacity);
+	if( heap == NULL )
+		capacity = 0;
+	failed = 0;
     pdata = data;
 }
 
 Heap::~Heap()
 {
 	size = -1;
+	free(heap);
 	heap = NULL;
     pdata = NULL;
 }
 
-void Heap::insert(hItem item)
+// inserts a BAND pixel with time T, or lowers/raises its time if it is in
+// the heap already; pixels with other flags are ignored. If the entries
+// cannot grow, the pixel is left out and outofmemory is set.
+void Heap::insert(int index, Real T)
 {
-    int index;
-
-    index = item.j * pdata->rows + item.i;
+	int pos;
+	int grown;
+	HeapItem *entries;
 
-	if(item.flag == BAND)
+	if(pdata->Flag[index] == BAND)
 	{
-		if(item.hpos == -1) // not yet in heap
+		if(pdata->hpos[index] == -1) // not yet in heap
 		{
+			if( size + 1 == capacity )
+			{
+				grown = (capacity > 0) ? 2 * capacity : HEAP_CAPACITY;
+				entries = (HeapItem *) realloc(heap, sizeof(HeapItem) * grown);
+				if( entries == NULL )
+				{
+					failed = 1;
+					return;
+				}
+				heap = entries;
+				capacity = grown;
+			}
+
 			// T update and heap insertion
-			pdata->Tfield[index].T = item.T;
+			pdata->Tfield[index] = T;
 			size = size + 1;
-			pdata->Tfield[index].hpos = size;
-			heap[size] = &(pdata->Tfield[index]);
+			heap[size].T = T;
+			heap[size].index = index;
 			upHeap(size);
-
 		}
 		else // already in heap
 		{
 			// only T update
-			double oldT = heap[item.hpos]->T;
-			heap[item.hpos]->T = item.T;
+			pos = pdata->hpos[index];
+			Real oldT = heap[pos].T;
+			pdata->Tfield[index] = T;
+			heap[pos].T = T;
 
-			if(oldT > item.T)
-				upHeap(item.hpos);
+			if(oldT > T)
+				upHeap(pos);
 			else
-				downHeap(item.hpos);
+				downHeap(pos);
 		}
 	}
 }
 
-hItem Heap::extract()
+// removes the pixel with the smallest time and returns its index
+int Heap::extract()
 {
-	hItem ret;
+	int ret;
+
+	ret = heap[0].index;
+	pdata->hpos[ret] = -1;
 
-	//heap[0]->flag = KNOWN;
-	ret = *heap[0];
-	
 	heap[0] = heap[size];
-	heap[0]->hpos = 0;
 	size = size - 1;
-	downHeap(0);
+	if( size >= 0 )
+		downHeap(0);
 
 	return ret;
 }
 
+// moves the entry at pos up to its place; the entries on the way move down
+// one level each
 void Heap::upHeap(int pos)
 {
-	int help = pos;
-	hItem *h;
+	int parent;
+	HeapItem item = heap[pos];
 
-	if( pos == 0) // head of heap
-		return;
-
-	while( (help != 0) && (heap[(help-1)/2]->T > heap[pos]->T))
+	while( pos > 0 )
 	{
-		help = (help-1)/2;
-	
-		if(help != pos)
-		{
-			// swap
-			h = heap[help];
-			heap[help] = heap[pos];
-			heap[help]->hpos = help;
-			heap[pos] = h;
-			heap[pos]->hpos = pos;
-
-		}
+		parent = (pos-1)/HEAP_ARITY;
+		if( !(heap[parent].T > item.T) )
+			break;
 
-		pos = help;
+		heap[pos] = heap[parent];
+		pdata->hpos[heap[pos].index] = pos;
+		pos = parent;
 	}
+
+	heap[pos] = item;
+	pdata->hpos[item.index] = pos;
 }
 
+// moves the entry at pos down to its place, along the smallest children
 void Heap::downHeap(int pos)
 {
-	int help = 2*pos+1; // left child
-	hItem *h;
+	int child,c,last;
+	HeapItem item = heap[pos];
 
-	if( help > size) // no children
-		return;
-	
-	// compare left with right child, that is help+1, if it exists
-	if( (help +1 <= size) && (heap[help]->T > heap[help+1]->T))
-		help = help+1;
-	// help is now index with Tmin
-
-	while( (help <= size)  && (heap[help]->T < heap[pos]->T))
+	while( 1 )
 	{
-		// swap
-		h = heap[help];
-		heap[help] = heap[pos];
-		heap[help]->hpos = help;
-		heap[pos] = h;
-		heap[pos]->hpos = pos;
-
-		pos = help;
-		help = 2*help+1; // left child
-		// compare left with right child, that is help+1, if it exists
-		if( (help +1 <= size) && (heap[help]->T > heap[help+1]->T))
-			help = help+1;
-			// help is now index with Tmin
+		child = HEAP_ARITY*pos+1; // first child
+		if( child > size ) // no children
+			break;
+
+		// child is now the one with Tmin
+		last = (child + HEAP_ARITY-1 < size) ? child + HEAP_ARITY-1 : size;
+		for( c = child+1 ; c <= last ; c++ )
+			if( heap[c].T < heap[child].T )
+				child = c;
+
+		if( !(heap[child].T < item.T) )
+			break;
+
+		heap[pos] = heap[child];
+		pdata->hpos[heap[pos].index] = pos;
+		pos = child;
 	}
+
+	heap[pos] = item;
+	pdata->hpos[item.index] = pos;
 }
 
 int Heap::isempty()
@@ -146,6 +167,148 @@ int Heap::isempty()
 		return 0;
 }
 
+int Heap::outofmemory()
+{
+	return failed;
+}
+
+UntidyHeap::UntidyHeap(Data *data)
+{
+	int b;
+
+	pdata = data;
+	failed = 0;
+
+	// a pixel is inserted at most 1 above the current T, so that and the
+	// current bucket fit on the ring
+	nbuckets = (int) ceil(1 / HEAP_BUCKET_WIDTH) + 2;
+	current = 0;
+	count = 0;
+
+	bucket = (int **) malloc(sizeof(int *) * nbuckets);
+	head = (int *) malloc(sizeof(int) * nbuckets);
+	tail = (int *) malloc(sizeof(int) * nbuckets);
+	room = (int *) malloc(sizeof(int) * nbuckets);
+	if( (bucket == NULL) || (head == NULL) || (tail == NULL) || (room == NULL) )
+	{
+		// no ring, every pixel is left out
+		free(bucket);
+		free(head);
+		free(tail);
+		free(room);
+		bucket = NULL;
+		nbuckets = 0;
+		return;
+	}
+
+	for( b=0 ; b < nbuckets ; b++ )
+	{
+		bucket[b] = (int *) malloc(sizeof(int) * HEAP_CAPACITY);
+		room[b] = (bucket[b] != NULL) ? HEAP_CAPACITY : 0;
+		head[b] = 0;
+		tail[b] = 0;
+	}
+}
+
+UntidyHeap::~UntidyHeap()
+{
+	int b;
+
+	if( bucket == NULL )
+		return;
+
+	for( b=0 ; b < nbuckets ; b++ )
+		free(bucket[b]);
+	free(bucket);
+	free(head);
+	free(tail);
+	free(room);
+}
+
+// as Heap::insert; a pixel moves to another bucket only if its time does.
+// If the bucket cannot grow, the pixel keeps its time and bucket, or is
+// left out, and outofmemory is set.
+void UntidyHeap::insert(int index, Real T)
+{
+	int b,r;
+	int grown;
+	int *entries;
+
+	if(pdata->Flag[index] != BAND)
+		return;
+
+	b = (int) floor(T / HEAP_BUCKET_WIDTH);
+	if( b < current )
+		b = current;
+	if( pdata->hpos[index] == b )
+	{
+		pdata->Tfield[index] = T;
+		return;
+	}
+
+	if( nbuckets == 0 )
+	{
+		failed = 1;
+		return;
+	}
+
+	r = b % nbuckets;
+	if( tail[r] == room[r] )
+	{
+		grown = (room[r] > 0) ? 2 * room[r] : HEAP_CAPACITY;
+		entries = (int *) realloc(bucket[r], sizeof(int) * grown);
+		if( entries == NULL )
+		{
+			failed = 1;
+			return;
+		}
+		bucket[r] = entries;
+		room[r] = grown;
+	}
+
+	pdata->Tfield[index] = T;
+	if( pdata->hpos[index] == -1 )
+		count = count + 1;
+	pdata->hpos[index] = b;
+	bucket[r][tail[r]++] = index;
+}
+
+// removes the first pixel of the lowest bucket and returns its index
+int UntidyHeap::extract()
+{
+	int b;
+	int index;
+
+	while( 1 )
+	{
+		b = current % nbuckets;
+		while( head[b] < tail[b] )
+		{
+			index = bucket[b][head[b]++];
+			if( pdata->hpos[index] == current ) // not moved on
+			{
+				pdata->hpos[index] = -1;
+				count = count - 1;
+				return index;
+			}
+		}
+
+		head[b] = 0;
+		tail[b] = 0;
+		current = current + 1;
+	}
+}
+
+int UntidyHeap::isempty()
+{
+	return count == 0;
+}
+
+int UntidyHeap::outofmemory()
+{
+	return failed;
+}
+
 // for debugging
 /*
 void Heap::heapPrint()
@@ -155,14 +318,14 @@ void Heap::heapPrint()
 	mexPrintf("\n");
 
 	for(i=0 ; i<= size; i++)
-		mexPrintf("% d. point (%d , %d) value %lf \n",i,(heap[i]->i)+1,(heap[i]->j)+1,heap[i]->T);
+		mexPrintf("% d. point (%d , %d) value %lf \n",i,heap[i].index % pdata->rows + 1,heap[i].index / pdata->rows + 1,heap[i].T);
 
 	mexPrintf("\n");
 
-	for(i = 0; i <= size; i= 2*i+1)
+	for(i = 0; i <= size; i= HEAP_ARITY*i+1)
 	{	
-		for( j=i ; (j < 2*i+1) && ( j <= size) ; j++)
-			mexPrintf(" %lf ",heap[j]->T);
+		for( j=i ; (j < HEAP_ARITY*i+1) && ( j <= size) ; j++)
+			mexPrintf(" %lf ",heap[j].T);
 
 		mexPrintf("\n");
 	}
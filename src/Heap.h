@@ -18,40 +18,80 @@
 #ifndef HEAP_H_
 #define HEAP_H_
 
-struct hItem;
 class Heap;
 
 #include "inpainting_func.h"
 
 enum Label {INSIDE,KNOWN,BAND,TO_INPAINT};
 
-struct hItem
+// children per node: a node and its children are at most two cache lines,
+// and the tree is half as deep as a binary one
+#define HEAP_ARITY 4
+
+// entry of the heap, the time is kept next to the pixel index so that the
+// sift loops do not read Tfield
+struct HeapItem
 {
-	double T;
-	Label flag;
-	int hpos;
-	int i;
-	int j;
+    Real T;
+    int index;
 };
 
+// min-heap of pixel indices ordered by data->Tfield; the position of a pixel
+// in the heap is kept in data->hpos. The entries only cover the narrow band
+// and grow with it.
 class Heap
 {
     public:
     Heap(Data *data);
-	virtual ~Heap();
+	~Heap();
 	//void heapPrint(void);
 	int isempty();
-	hItem extract(void);
-	void insert(hItem item);
+	int extract(void);
+	void insert(int index, Real T);
+	int outofmemory();
 
     private:
-	int size;
-	hItem **heap;
+	int size; // position of the last entry, -1 if empty
+	int capacity;
+	HeapItem *heap;
+	int failed; // an insert found no memory and left its pixel out
     Data *pdata;
 
-    protected:
 	void downHeap(int pos);
 	void upHeap(int pos);
 };
 
+// width in T of the buckets of UntidyHeap
+#define HEAP_BUCKET_WIDTH 0.125
+
+// untidy priority queue (Yatziv, Bartesaghi, Sapiro 2006): the pixels go to
+// buckets of HEAP_BUCKET_WIDTH in T and leave a bucket in the order they came
+// in, a pixel below the current bucket goes to the current one. Insert and
+// extract take O(1) instead of O(log n); the order is the one of T up to
+// about the bucket width. The buckets form a ring over the largest step of
+// solve, 1. data->hpos holds the bucket of a pixel, entries left behind by
+// a change of T are skipped. It has the interface of Heap but no common
+// base, OrderByDistance is a template over the queue.
+class UntidyHeap
+{
+    public:
+    UntidyHeap(Data *data);
+	~UntidyHeap();
+	int isempty();
+	int extract(void);
+	void insert(int index, Real T);
+	int outofmemory();
+
+    private:
+	Data *pdata;
+	int failed;   // an insert found no memory
+	int nbuckets; // on the ring
+	int current;  // bucket extracted from
+	int count;    // pixels in the buckets
+	int **bucket;
+	int *head;    // next entry of a bucket to extract
+	int *tail;    // end of its entries
+	int *room;    // and their room
+};
+
 #endif
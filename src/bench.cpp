@@ -0,0 +1,302 @@
+/* bench.cpp  --- inpaintBCT
+ * Copyright (C) 2013 Thomas März (maerz@maths.ox.ac.uk)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* inpaint-bct-bench: timings of the engine kernels on synthetic data.
+ *
+ * Every line of the output is tab separated:
+ *   kernel channels epsilon sigma rho calls ns_per_call calls_per_s
+ * where a call is one point for inpaintPoint, ModStructureTensor,
+ * SmoothUpdateLevel and solve, one pixel of one plane for SmoothImage and one
+ * insert or extract for the heap.
+ *
+ * The options that inpaint-bct has as well use its letters: -i recursive
+ * smoothing, -f, -q and -w CUTOFF. -g SIZE is the side of the square test
+ * image and -l the interleaved layout of the engine buffers, which
+ * inpaint-bct always uses.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "inpainting_func.h"
+
+
+struct Timing
+{
+    double ns;
+    long calls;
+};
+
+// image layout of the engine buffers
+static int layout = LAYOUT_PLANAR;
+
+// pre-smoothing with SKernel1 or recursive
+static int smoothing = SMOOTHING_FIR;
+
+// weights with exp, FastExp or in fixed point
+static int precision = PRECISION_EXACT;
+
+// anisotropic weight below which neighbours are skipped
+static double cutoff = 0;
+
+static double Now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void Report(const char *kernel, Data *data, Timing *t)
+{
+    double per_call = t->calls > 0 ? t->ns / t->calls : 0;
+
+    printf("%s\t%d\t%g\t%g\t%g\t%ld\t%.1f\t%.0f\n",
+           kernel, data->channels, data->epsilon, data->sigma, data->rho,
+           t->calls, per_call, per_call > 0 ? 1e9 / per_call : 0);
+    fflush(stdout);
+}
+
+// smooth test pattern with a disc shaped hole in the centre
+static void SetupData(Data *data, int n, int channels, double epsilon, double sigma, double rho)
+{
+    unsigned char *pixel;
+    unsigned char *mpixel;
+    int i,j,c;
+    double di,dj;
+    double radius = 0.3 * n;
+
+    SetDefaults(data);
+    data->rows = n;
+    data->cols = n;
+    data->channels = channels;
+    data->layout = layout;
+    data->smoothing = smoothing;
+    data->precision = precision;
+    data->cutoff = cutoff;
+    data->epsilon = epsilon;
+    data->radius = (int) (epsilon + 0.5);
+    data->sigma = sigma;
+    data->rho = rho;
+
+    data->convex = (double *) AllocMem(sizeof(double) * channels);
+    for( c=0 ; c < channels ; c++ )
+        data->convex[c] = 100.0/channels;
+
+    AllocBuffers(data);
+
+    pixel = (unsigned char *) AllocMem(channels * n);
+    mpixel = (unsigned char *) AllocMem(n);
+
+    for( i=0 ; i < n ; i++ )
+    {
+        for( j=0 ; j < n ; j++ )
+        {
+            for( c=0 ; c < channels ; c++ )
+                pixel[j*channels + c] = (unsigned char) (127.5 + 60 * sin(0.07*j + 0.03*i + c) + 40 * cos(0.11*i - 0.05*j));
+
+            di = i - 0.5*n;
+            dj = j - 0.5*n;
+            mpixel[j] = (di*di + dj*dj < radius*radius) ? 255 : 0;
+        }
+        SetImageRow(data, i, pixel, channels, mpixel, 1);
+    }
+
+    FreeMem(pixel);
+    FreeMem(mpixel);
+
+    SetKernels(data);
+}
+
+// InpaintByOrder reports the end of each stage; the time since the previous
+// report goes to the stage, so that Now() is called once per level and not
+// per point
+struct StageTimes
+{
+    double last;
+    Timing *point;
+    Timing *update;
+};
+
+static void TimeStage(int stage, int points, void *user_data)
+{
+    StageTimes *st = (StageTimes *) user_data;
+    double t = Now();
+
+    if( stage == STAGE_UPDATE )
+    {
+        st->update->ns += t - st->last;
+        st->update->calls += points;
+    }
+    else if( stage == STAGE_LEVEL )
+    {
+        st->point->ns += t - st->last;
+        st->point->calls += points;
+    }
+    st->last = t;
+}
+
+static void BenchEngine(int n, int channels, double epsilon, double sigma, double rho)
+{
+    Data data;
+    Timing tsmooth = {0,0};
+    Timing tsolve = {0,0};
+    Timing tpoint = {0,0};
+    Timing ttensor = {0,0};
+    Timing tupdate = {0,0};
+    StageTimes st;
+    double ST[3];
+    int i,j,k;
+    double t0;
+    volatile double sink = 0;
+
+    SetupData(&data, n, channels, epsilon, sigma, rho);
+
+    t0 = Now();
+    SmoothImage(&data);
+    tsmooth.ns = Now() - t0;
+    if( data.SKernel1 != NULL )
+        tsmooth.calls = (long) data.size * (data.channels + 1);
+
+    OrderByDistance(&data);
+
+    // solve on every point of the hole, with the final distances as neighbours
+    t0 = Now();
+    for( k=0 ; k < 3 * data.nof_points2inpaint ; k=k+3 )
+    {
+        i = (int) data.ordered_points[k];
+        j = (int) data.ordered_points[k+1];
+        sink += solve(&data, i, j);
+    }
+    tsolve.ns = Now() - t0;
+    tsolve.calls = data.nof_points2inpaint;
+
+    // the engine loop itself, inpaintPoint and SmoothUpdateLevel per level
+    st.point = &tpoint;
+    st.update = &tupdate;
+    data.stage = TimeStage;
+    data.callback_data = &st;
+    st.last = Now();
+    InpaintByOrder(&data);
+
+    // ModStructureTensor on every point of the hole, on the inpainted image
+    t0 = Now();
+    for( k=0 ; k < 3 * data.nof_points2inpaint ; k=k+3 )
+    {
+        i = (int) data.ordered_points[k];
+        j = (int) data.ordered_points[k+1];
+        ModStructureTensor(&data, i, j, ST);
+        sink += ST[0];
+    }
+    ttensor.ns = Now() - t0;
+    ttensor.calls = data.nof_points2inpaint;
+
+    Report("SmoothImage", &data, &tsmooth);
+    Report("solve", &data, &tsolve);
+    Report("ModStructureTensor", &data, &ttensor);
+    Report("inpaintPoint", &data, &tpoint);
+    Report("SmoothUpdateLevel", &data, &tupdate);
+
+    ClearMemory(&data);
+}
+
+static void BenchHeap(int n)
+{
+    Data data;
+    Timing tinsert = {0,0};
+    Timing textract = {0,0};
+    int index;
+    double t0;
+    unsigned int seed = 1;
+
+    SetupData(&data, n, 1, 1, 0, 1);
+
+    for( index=0 ; index < data.size ; index++ )
+    {
+        data.hpos[index] = -1;
+        data.Flag[index] = BAND;
+    }
+
+    Heap H(&data);
+
+    t0 = Now();
+    for( index=0 ; index < data.size ; index++ )
+    {
+        seed = seed * 1103515245 + 12345;
+        H.insert(index, (seed >> 8) * (1.0 / (1 << 24)));
+    }
+    tinsert.ns = Now() - t0;
+    tinsert.calls = data.size;
+
+    t0 = Now();
+    while( !H.isempty() )
+        H.extract();
+    textract.ns = Now() - t0;
+    textract.calls = data.size;
+
+    Report("Heap::insert", &data, &tinsert);
+    Report("Heap::extract", &data, &textract);
+
+    ClearMemory(&data);
+}
+
+int main(int argc, char *argv[])
+{
+    static const int channels[] = {1, 3, 4};
+    static const double epsilon[] = {3, 5, 10};
+    static const double sigma[] = {0, 1.41, 4};
+    static const double rho[] = {2, 4, 8};
+    int n = 256;
+    int opt;
+    unsigned int c,e,s,r;
+
+    while( (opt = getopt(argc, argv, "g:lifqw:h")) != -1 )
+    {
+        switch( opt )
+        {
+            case 'g': n = atoi(optarg); break;
+            case 'l': layout = LAYOUT_INTERLEAVED; break;
+            case 'i': smoothing = SMOOTHING_RECURSIVE; break;
+            case 'f': precision = PRECISION_FAST; break;
+            case 'q': precision = PRECISION_FIXED; break;
+            case 'w': cutoff = atof(optarg); break;
+            default:
+                fprintf(stderr, "Usage: %s [-g SIZE] [-l] [-i] [-f] [-q] [-w CUTOFF]\n", argv[0]);
+                return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    printf("kernel\tchannels\tepsilon\tsigma\trho\tcalls\tns_per_call\tcalls_per_s\n");
+
+    BenchHeap(n);
+
+    // vary one parameter at a time around the plug-in defaults
+    for( c=0 ; c < sizeof(channels)/sizeof(channels[0]) ; c++ )
+        BenchEngine(n, channels[c], 5, 1.41, 4);
+    for( e=0 ; e < sizeof(epsilon)/sizeof(epsilon[0]) ; e++ )
+        if( epsilon[e] != 5 )
+            BenchEngine(n, 3, epsilon[e], 1.41, 4);
+    for( s=0 ; s < sizeof(sigma)/sizeof(sigma[0]) ; s++ )
+        if( sigma[s] != 1.41 )
+            BenchEngine(n, 3, 5, sigma[s], 4);
+    for( r=0 ; r < sizeof(rho)/sizeof(rho[0]) ; r++ )
+        if( rho[r] != 4 )
+            BenchEngine(n, 3, 5, 1.41, rho[r]);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,297 @@
+/* cli.cpp  --- inpaintBCT
+ * Copyright (C) 2013 Thomas März (maerz@maths.ox.ac.uk)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* inpaint-bct: headless inpainting of an image file with a mask file.
+ *
+ * The image and the mask are streamed row by row into the engine buffers,
+ * so no GIMP instance is needed. Nonzero pixels in the first channel of
+ * the mask are inpainted, as in the plug-in.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "inpainting_func.h"
+#include "image_io.h"
+
+
+static void Usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [options] IMAGE MASK OUTPUT\n"
+            "\n"
+            "Inpaints the pixels of IMAGE where the first channel of MASK is nonzero\n"
+            "and writes the result to OUTPUT. Images may be PNG, PAM/PPM/PGM or raw\n"
+            "8 bit planar files; the output format follows the OUTPUT extension.\n"
+            "\n"
+            "Options:\n"
+            "  -e EPSILON   pixel neighborhood (default 5)\n"
+            "  -k KAPPA     sharpness in %% (default 25)\n"
+            "  -s SIGMA     pre-smoothing (default 1.41)\n"
+            "  -i           pre-smooth with a recursive Gaussian, at a cost\n"
+            "               independent of SIGMA; for large SIGMA\n"
+            "  -r RHO       post-smoothing (default 4)\n"
+            "  -g WxH       geometry of raw input files\n"
+            "  -c CHANNELS  number of channels of a raw input image (default 3)\n"
+            "  -t THREADS   number of threads (default: all cores)\n"
+            "  -b WIDTH     inpaint in relaxed bands of this width in T, trading\n"
+            "               exactness of the order for parallelism (default 0)\n"
+            "  -x           schedule by dependencies across T-levels, for more\n"
+            "               parallelism with the exact serial result\n"
+            "  -u           order by a fast marching over buckets of T, in linear\n"
+            "               time; the order is off by up to about 1/8 in T\n"
+            "  -p           order by sweeps over tiles of the image in parallel,\n"
+            "               for large holes on many cores\n"
+            "  -f           weight with a fast approximation of exp, the result\n"
+            "               differs slightly from the exact one\n"
+            "  -q           weight in 16 bit fixed point, faster for 8 bit images;\n"
+            "               the result differs by a few grey levels. Takes 2 more\n"
+            "               bytes per sample for the fixed point copy of the image\n"
+            "  -w CUTOFF    skip the neighbors whose anisotropic weight is below\n"
+            "               CUTOFF, e.g. 1e-6; faster for large EPSILON (default 0)\n"
+            "  -n RADIUS    weight the neighbors beyond RADIUS approximately, from\n"
+            "               sums over blocks; for very large EPSILON, not with -x\n"
+            "               (default 0)\n"
+            "  -m           inpaint the components of the mask separately and\n"
+            "               concurrently, memory scales with the holes\n"
+            "  -v           report progress on stderr\n"
+            "  -h           show this help\n",
+            prog);
+}
+
+static void PrintProgress(double fraction, void *user_data)
+{
+    fprintf(stderr, "\r%3d%%", (int) (100 * fraction));
+    fflush(stderr);
+}
+
+static void PrintMessage(const char *message, void *user_data)
+{
+    fprintf(stderr, "%s", message);
+}
+
+static int Fail(const char *what, int err)
+{
+    fprintf(stderr, "Error: %s: %s\n", what, ImageErrorString(err));
+    return EXIT_FAILURE;
+}
+
+int main(int argc, char *argv[])
+{
+    Data data;
+    ImageFile image, mask, output;
+    int raw_width = 0;
+    int raw_height = 0;
+    int raw_channels = 3;
+    int verbose = 0;
+    int components = 0;
+    int format;
+    int opt;
+    int err;
+    int i,j;
+    unsigned char *pixel;
+    unsigned char *mpixel;
+    unsigned char *alpha = NULL;
+
+    SetDefaults(&data);
+    data.layout = LAYOUT_INTERLEAVED;
+
+    // defaults of the plug-in dialog
+    data.epsilon = 5;
+    data.kappa = 25;
+    data.sigma = 1.41;
+    data.rho = 4;
+
+    while( (opt = getopt(argc, argv, "e:k:s:ir:g:c:t:b:xupfqw:n:mvh")) != -1 )
+    {
+        switch( opt )
+        {
+            case 'e': data.epsilon = atof(optarg); break;
+            case 'k': data.kappa = atof(optarg); break;
+            case 's': data.sigma = atof(optarg); break;
+            case 'i': data.smoothing = SMOOTHING_RECURSIVE; break;
+            case 'r': data.rho = atof(optarg); break;
+            case 'g':
+                if( sscanf(optarg, "%dx%d", &raw_width, &raw_height) != 2 || raw_width <= 0 || raw_height <= 0 )
+                {
+                    fprintf(stderr, "Error: invalid geometry %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'c': raw_channels = atoi(optarg); break;
+            case 't': data.threads = atoi(optarg); break;
+            case 'b': data.tband = atof(optarg); break;
+            case 'x': data.scheduler = SCHEDULE_WAVES; break;
+            case 'u': data.marching = MARCHING_UNTIDY; break;
+            case 'p': data.marching = MARCHING_SWEEPS; break;
+            case 'f': data.precision = PRECISION_FAST; break;
+            case 'q': data.precision = PRECISION_FIXED; break;
+            case 'w': data.cutoff = atof(optarg); break;
+            case 'n': data.nearfield = atoi(optarg); break;
+            case 'm': components = 1; break;
+            case 'v': verbose = 1; break;
+            case 'h': Usage(argv[0]); return EXIT_SUCCESS;
+            default: Usage(argv[0]); return EXIT_FAILURE;
+        }
+    }
+
+    if( argc - optind != 3 )
+    {
+        Usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // same parameter handling as GetParam in the plug-in
+    data.radius = (int) (data.epsilon + 0.5);
+    data.delta_quant4 = 1;
+    data.guidance = 1;
+    data.ordergiven = 0;
+
+    if( (data.epsilon < 1 ) || ( data.kappa < 0 ) || ( data.sigma < 0) || ( data.rho <= 0 ) || (raw_channels < 1) || (data.threads < 0) || (data.tband < 0) || (data.cutoff < 0) || (data.cutoff >= 1) || (data.nearfield < 0) )
+    {
+        fprintf(stderr, "Error in the parameter values: \n");
+        fprintf(stderr, "Epsilon must be greater than or equal 1. \n");
+        fprintf(stderr, "The parameters kappa and sigma must be greater than or equal zero. \n");
+        fprintf(stderr, "Rho must be greater than zero \n");
+        fprintf(stderr, "The cutoff must be in [0,1). \n");
+        return EXIT_FAILURE;
+    }
+
+    if( (data.scheduler == SCHEDULE_WAVES) && (data.nearfield > 0) && (data.nearfield < data.radius) )
+    {
+        fprintf(stderr, "Error: -x does not combine with -n. \n");
+        return EXIT_FAILURE;
+    }
+
+    data.message = PrintMessage;
+    if( verbose )
+        data.progress = PrintProgress;
+
+    // open input
+    err = OpenImageRead(&image, argv[optind], raw_width, raw_height, raw_channels);
+    if( err )
+        return Fail(argv[optind], err);
+
+    err = OpenImageRead(&mask, argv[optind+1], raw_width, raw_height, 1);
+    if( err )
+        return Fail(argv[optind+1], err);
+
+    if( (image.width != mask.width) || (image.height != mask.height) )
+    {
+        fprintf(stderr, "Error: Mask <-> Image dimension mismatch \n");
+        return EXIT_FAILURE;
+    }
+
+    data.rows = image.height;
+    data.cols = image.width;
+    data.channels = image.channels - image.has_alpha;
+
+    data.convex = (double *) AllocMem(sizeof(double) * data.channels);
+    for( i=0 ; i < data.channels ; i++ )
+        data.convex[i] = 100.0/data.channels;
+
+    // the components get their own workspace
+    if( components )
+        AllocImage(&data);
+    else
+        AllocBuffers(&data);
+
+    pixel = (unsigned char *) AllocMem(image.channels * image.width);
+    mpixel = (unsigned char *) AllocMem(mask.channels * mask.width);
+    if( image.has_alpha )
+        alpha = (unsigned char *) AllocMem(image.width * image.height);
+
+    // stream rows into the engine buffers
+    for( i=0 ; i < data.rows ; i++ )
+    {
+        if( (err = ReadImageRow(&image, i, pixel)) )
+            return Fail(argv[optind], err);
+        if( (err = ReadImageRow(&mask, i, mpixel)) )
+            return Fail(argv[optind+1], err);
+
+        SetImageRow(&data, i, pixel, image.channels, mpixel, mask.channels);
+
+        if( alpha != NULL )
+            for( j=0 ; j < image.width ; j++ )
+                alpha[i * image.width + j] = pixel[j * image.channels + data.channels];
+    }
+
+    CloseImage(&mask);
+    CloseImage(&image);
+
+    if( data.nof_points2inpaint == 0 )
+    {
+        fprintf(stderr, "Error: Empty mask, nothing to do \n");
+        ClearMemory(&data);
+        return EXIT_FAILURE;
+    }
+
+    // inpaint
+    if( data.guidance == 1 )
+        SetKernels(&data);
+
+    if( components )
+        InpaintComponents(&data);
+    else
+        InpaintImage(&data);
+
+    if( verbose )
+        fprintf(stderr, "\n");
+
+    if( verbose && (data.marching == MARCHING_UNTIDY) )
+        fprintf(stderr, "Order: T set back by up to %g \n", data.order_deviation);
+
+    if( data.inpaint_undefined == 1 )
+        fprintf(stderr, "Warning: Some inpainted image values are undefined, the order is not well-defined. \n");
+
+    // write result
+    format = FormatFromName(argv[optind+2]);
+    if( format == FORMAT_NONE )
+        format = image.format;
+
+    err = OpenImageWrite(&output, argv[optind+2], format, image.width, image.height, image.channels, image.has_alpha);
+    if( err )
+        return Fail(argv[optind+2], err);
+
+    for( i=0 ; i < data.rows ; i++ )
+    {
+        GetImageRow(&data, i, pixel, image.channels);
+
+        if( alpha != NULL )
+            for( j=0 ; j < image.width ; j++ )
+                pixel[j * image.channels + data.channels] = alpha[i * image.width + j];
+
+        if( (err = WriteImageRow(&output, i, pixel)) )
+            return Fail(argv[optind+2], err);
+    }
+
+    err = CloseImage(&output);
+    if( err )
+        return Fail(argv[optind+2], err);
+
+    FreeMem(pixel);
+    FreeMem(mpixel);
+    if( alpha != NULL )
+        FreeMem(alpha);
+    ClearMemory(&data);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,500 @@
+/* image_io.cpp  --- inpaintBCT
+ * Copyright (C) 2013 Thomas März (maerz@maths.ox.ac.uk)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "image_io.h"
+
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <stdlib.h>
+
+#ifdef HAVE_LIBPNG
+#include <png.h>
+#endif
+
+
+static void InitImageFile(ImageFile *img)
+{
+    img->fp = NULL;
+    img->format = FORMAT_NONE;
+    img->width = 0;
+    img->height = 0;
+    img->channels = 0;
+    img->has_alpha = 0;
+    img->data_offset = 0;
+    img->writing = 0;
+    img->png = NULL;
+    img->info = NULL;
+}
+
+int FormatFromName(const char *filename)
+{
+    const char *ext = strrchr(filename, '.');
+
+    if( ext == NULL )
+        return FORMAT_NONE;
+
+    if( strcasecmp(ext, ".png") == 0 )
+        return FORMAT_PNG;
+    if( (strcasecmp(ext, ".pam") == 0) || (strcasecmp(ext, ".pnm") == 0)
+        || (strcasecmp(ext, ".ppm") == 0) || (strcasecmp(ext, ".pgm") == 0) )
+        return FORMAT_PAM;
+    if( strcasecmp(ext, ".raw") == 0 )
+        return FORMAT_RAW;
+
+    return FORMAT_NONE;
+}
+
+// PAM / PNM
+
+// reads the next whitespace separated token of a netpbm header, skipping comments
+static int ReadToken(FILE *fp, char *token, int len)
+{
+    int ch;
+    int n = 0;
+
+    do
+    {
+        ch = fgetc(fp);
+        if( ch == '#' )
+            while( (ch != '\n') && (ch != EOF) )
+                ch = fgetc(fp);
+    } while( (ch != EOF) && isspace(ch) );
+
+    while( (ch != EOF) && !isspace(ch) && (n < len-1) )
+    {
+        token[n++] = (char) ch;
+        ch = fgetc(fp);
+    }
+    token[n] = 0;
+
+    // the whitespace after the token is consumed as well, so after the
+    // last header token the file is positioned at the first sample
+    return n > 0 ? IO_OK : IO_ERR_FORMAT;
+}
+
+static int ReadPNMHeader(ImageFile *img, int magic)
+{
+    char token[32];
+    int maxval;
+
+    if( ReadToken(img->fp, token, sizeof(token)) ) return IO_ERR_FORMAT;
+    img->width = atoi(token);
+    if( ReadToken(img->fp, token, sizeof(token)) ) return IO_ERR_FORMAT;
+    img->height = atoi(token);
+    if( ReadToken(img->fp, token, sizeof(token)) ) return IO_ERR_FORMAT;
+    maxval = atoi(token);
+
+    if( (img->width <= 0) || (img->height <= 0) )
+        return IO_ERR_FORMAT;
+    // the samples are used as they are, so only the full 8 bit range
+    if( maxval != 255 )
+        return IO_ERR_DEPTH;
+
+    img->channels = (magic == '5') ? 1 : 3;
+    img->has_alpha = 0;
+
+    return IO_OK;
+}
+
+static int ReadPAMHeader(ImageFile *img)
+{
+    char token[32];
+    int maxval = 255;
+
+    img->channels = 0;
+
+    while( ReadToken(img->fp, token, sizeof(token)) == IO_OK )
+    {
+        if( strcmp(token, "ENDHDR") == 0 )
+        {
+            if( (img->width <= 0) || (img->height <= 0) || (img->channels <= 0) )
+                return IO_ERR_FORMAT;
+            if( maxval != 255 )
+                return IO_ERR_DEPTH;
+            return IO_OK;
+        }
+
+        if( strcmp(token, "TUPLTYPE") == 0 )
+        {
+            if( ReadToken(img->fp, token, sizeof(token)) ) return IO_ERR_FORMAT;
+            img->has_alpha = (strstr(token, "_ALPHA") != NULL);
+            continue;
+        }
+
+        if( strcmp(token, "WIDTH") == 0 )
+        {
+            if( ReadToken(img->fp, token, sizeof(token)) ) return IO_ERR_FORMAT;
+            img->width = atoi(token);
+        }
+        else if( strcmp(token, "HEIGHT") == 0 )
+        {
+            if( ReadToken(img->fp, token, sizeof(token)) ) return IO_ERR_FORMAT;
+            img->height = atoi(token);
+        }
+        else if( strcmp(token, "DEPTH") == 0 )
+        {
+            if( ReadToken(img->fp, token, sizeof(token)) ) return IO_ERR_FORMAT;
+            img->channels = atoi(token);
+        }
+        else if( strcmp(token, "MAXVAL") == 0 )
+        {
+            if( ReadToken(img->fp, token, sizeof(token)) ) return IO_ERR_FORMAT;
+            maxval = atoi(token);
+        }
+        else
+            return IO_ERR_FORMAT;
+    }
+
+    return IO_ERR_FORMAT;
+}
+
+// P5/P6 for gray and RGB images without alpha unless pam is set, as for a
+// .pam file name; P7 otherwise
+static int WritePAMHeader(ImageFile *img, int pam)
+{
+    int err;
+
+    if( (img->channels == 1) && !img->has_alpha && !pam )
+        err = fprintf(img->fp, "P5\n%d %d\n255\n", img->width, img->height);
+    else if( (img->channels == 3) && !img->has_alpha && !pam )
+        err = fprintf(img->fp, "P6\n%d %d\n255\n", img->width, img->height);
+    else
+    {
+        const char *tupltype;
+
+        switch( img->channels )
+        {
+            case 1: tupltype = "GRAYSCALE"; break;
+            case 2: tupltype = "GRAYSCALE_ALPHA"; break;
+            case 3: tupltype = "RGB"; break;
+            case 4: tupltype = img->has_alpha ? "RGB_ALPHA" : "CMYK"; break;
+            default: tupltype = "UNKNOWN";
+        }
+
+        err = fprintf(img->fp, "P7\nWIDTH %d\nHEIGHT %d\nDEPTH %d\nMAXVAL 255\nTUPLTYPE %s\nENDHDR\n",
+                      img->width, img->height, img->channels, tupltype);
+    }
+
+    return err < 0 ? IO_ERR_WRITE : IO_OK;
+}
+
+// PNG
+
+#ifdef HAVE_LIBPNG
+static int OpenPNGRead(ImageFile *img)
+{
+    png_structp png;
+    png_infop info;
+    int color_type;
+
+    png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    if( png == NULL )
+        return IO_ERR_READ;
+    info = png_create_info_struct(png);
+    if( info == NULL )
+    {
+        png_destroy_read_struct(&png, NULL, NULL);
+        return IO_ERR_READ;
+    }
+    img->png = png;
+    img->info = info;
+
+    if( setjmp(png_jmpbuf(png)) )
+        return IO_ERR_READ;
+
+    png_init_io(png, img->fp);
+    png_read_info(png, info);
+
+    // rows can only be streamed from non-interlaced files
+    if( png_get_interlace_type(png, info) != PNG_INTERLACE_NONE )
+        return IO_ERR_FORMAT;
+
+    // everything is delivered as 8 bit gray/rgb with optional alpha
+    png_set_expand(png);
+    png_set_strip_16(png);
+    png_set_packing(png);
+    png_read_update_info(png, info);
+
+    color_type = png_get_color_type(png, info);
+    img->width = png_get_image_width(png, info);
+    img->height = png_get_image_height(png, info);
+    img->channels = png_get_channels(png, info);
+    img->has_alpha = (color_type & PNG_COLOR_MASK_ALPHA) != 0;
+
+    return IO_OK;
+}
+
+static int OpenPNGWrite(ImageFile *img)
+{
+    png_structp png;
+    png_infop info;
+    int color_type;
+
+    png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    if( png == NULL )
+        return IO_ERR_WRITE;
+    info = png_create_info_struct(png);
+    if( info == NULL )
+    {
+        png_destroy_write_struct(&png, NULL);
+        return IO_ERR_WRITE;
+    }
+    img->png = png;
+    img->info = info;
+
+    if( setjmp(png_jmpbuf(png)) )
+        return IO_ERR_WRITE;
+
+    switch( img->channels )
+    {
+        case 1: color_type = PNG_COLOR_TYPE_GRAY; break;
+        case 2: color_type = PNG_COLOR_TYPE_GRAY_ALPHA; break;
+        case 3: color_type = PNG_COLOR_TYPE_RGB; break;
+        case 4: color_type = PNG_COLOR_TYPE_RGB_ALPHA; break;
+        default: return IO_ERR_FORMAT;
+    }
+
+    png_init_io(png, img->fp);
+    png_set_IHDR(png, info, img->width, img->height, 8, color_type,
+                 PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+    png_write_info(png, info);
+
+    return IO_OK;
+}
+#endif
+
+// public functions
+
+int OpenImageRead(ImageFile *img, const char *filename, int raw_width, int raw_height, int raw_channels)
+{
+    unsigned char magic[8];
+    size_t n;
+
+    InitImageFile(img);
+
+    img->fp = fopen(filename, "rb");
+    if( img->fp == NULL )
+        return IO_ERR_OPEN;
+
+    n = fread(magic, 1, sizeof(magic), img->fp);
+
+    if( (n == 8) && (memcmp(magic, "\211PNG\r\n\032\n", 8) == 0) )
+    {
+#ifdef HAVE_LIBPNG
+        rewind(img->fp);
+        img->format = FORMAT_PNG;
+        return OpenPNGRead(img);
+#else
+        return IO_ERR_NO_PNG;
+#endif
+    }
+
+    if( (n >= 3) && (magic[0] == 'P') && ((magic[1] == '5') || (magic[1] == '6') || (magic[1] == '7')) && isspace(magic[2]) )
+    {
+        int err;
+
+        fseek(img->fp, 2, SEEK_SET);
+        img->format = FORMAT_PAM;
+        if( magic[1] == '7' )
+            err = ReadPAMHeader(img);
+        else
+            err = ReadPNMHeader(img, magic[1]);
+        return err;
+    }
+
+    if( raw_width > 0 )
+    {
+        img->format = FORMAT_RAW;
+        img->width = raw_width;
+        img->height = raw_height;
+        img->channels = raw_channels;
+        img->has_alpha = 0;
+        img->data_offset = 0;
+
+        fseek(img->fp, 0, SEEK_END);
+        if( ftell(img->fp) < (long)raw_width * raw_height * raw_channels )
+            return IO_ERR_GEOMETRY;
+        return IO_OK;
+    }
+
+    return IO_ERR_FORMAT;
+}
+
+int ReadImageRow(ImageFile *img, int y, unsigned char *row)
+{
+    int c,x;
+
+    switch( img->format )
+    {
+#ifdef HAVE_LIBPNG
+        case FORMAT_PNG:
+            if( setjmp(png_jmpbuf((png_structp) img->png)) )
+                return IO_ERR_READ;
+            png_read_row((png_structp) img->png, row, NULL);
+            return IO_OK;
+#endif
+
+        case FORMAT_PAM:
+            if( fread(row, img->channels, img->width, img->fp) != (size_t) img->width )
+                return IO_ERR_READ;
+            return IO_OK;
+
+        case FORMAT_RAW:
+            // plane c of row y starts at (c * height + y) * width
+            for( c=0 ; c < img->channels ; c++ )
+            {
+                fseek(img->fp, img->data_offset + ((long)c * img->height + y) * img->width, SEEK_SET);
+                for( x=0 ; x < img->width ; x++ )
+                {
+                    int v = fgetc(img->fp);
+                    if( v == EOF )
+                        return IO_ERR_READ;
+                    row[x * img->channels + c] = (unsigned char) v;
+                }
+            }
+            return IO_OK;
+    }
+
+    return IO_ERR_FORMAT;
+}
+
+int OpenImageWrite(ImageFile *img, const char *filename, int format, int width, int height, int channels, int has_alpha)
+{
+    const char *ext;
+
+    InitImageFile(img);
+
+    img->writing = 1;
+    img->format = format;
+    img->width = width;
+    img->height = height;
+    img->channels = channels;
+    img->has_alpha = has_alpha;
+
+#ifndef HAVE_LIBPNG
+    if( format == FORMAT_PNG )
+        return IO_ERR_NO_PNG;
+#endif
+
+    img->fp = fopen(filename, "wb");
+    if( img->fp == NULL )
+        return IO_ERR_OPEN;
+
+    switch( format )
+    {
+#ifdef HAVE_LIBPNG
+        case FORMAT_PNG:
+            return OpenPNGWrite(img);
+#endif
+        case FORMAT_PAM:
+            ext = strrchr(filename, '.');
+            return WritePAMHeader(img, (ext != NULL) && (strcasecmp(ext, ".pam") == 0));
+        case FORMAT_RAW:
+            return IO_OK;
+    }
+
+    return IO_ERR_FORMAT;
+}
+
+int WriteImageRow(ImageFile *img, int y, const unsigned char *row)
+{
+    int c,x;
+
+    switch( img->format )
+    {
+#ifdef HAVE_LIBPNG
+        case FORMAT_PNG:
+            if( setjmp(png_jmpbuf((png_structp) img->png)) )
+                return IO_ERR_WRITE;
+            png_write_row((png_structp) img->png, (png_bytep) row);
+            return IO_OK;
+#endif
+
+        case FORMAT_PAM:
+            if( fwrite(row, img->channels, img->width, img->fp) != (size_t) img->width )
+                return IO_ERR_WRITE;
+            return IO_OK;
+
+        case FORMAT_RAW:
+            for( c=0 ; c < img->channels ; c++ )
+            {
+                fseek(img->fp, ((long)c * img->height + y) * img->width, SEEK_SET);
+                for( x=0 ; x < img->width ; x++ )
+                    if( fputc(row[x * img->channels + c], img->fp) == EOF )
+                        return IO_ERR_WRITE;
+            }
+            return IO_OK;
+    }
+
+    return IO_ERR_FORMAT;
+}
+
+int CloseImage(ImageFile *img)
+{
+    // set after the setjmp, and read after a longjmp back to it
+    volatile int err = IO_OK;
+
+#ifdef HAVE_LIBPNG
+    if( img->png != NULL )
+    {
+        png_structp png = (png_structp) img->png;
+        png_infop info = (png_infop) img->info;
+
+        if( img->writing )
+        {
+            if( setjmp(png_jmpbuf(png)) )
+                err = IO_ERR_WRITE;
+            else
+                png_write_end(png, info);
+            png_destroy_write_struct(&png, &info);
+        }
+        else
+            png_destroy_read_struct(&png, &info, NULL);
+
+        img->png = NULL;
+        img->info = NULL;
+    }
+#endif
+
+    if( img->fp != NULL )
+    {
+        if( fclose(img->fp) != 0 )
+            err = IO_ERR_WRITE;
+        img->fp = NULL;
+    }
+
+    return err;
+}
+
+const char *ImageErrorString(int err)
+{
+    switch( err )
+    {
+        case IO_OK: return "no error";
+        case IO_ERR_OPEN: return "cannot open file";
+        case IO_ERR_FORMAT: return "unsupported file format";
+        case IO_ERR_DEPTH: return "only 8 bit images (maxval 255) are supported";
+        case IO_ERR_READ: return "read error";
+        case IO_ERR_WRITE: return "write error";
+        case IO_ERR_NO_PNG: return "built without PNG support";
+        case IO_ERR_GEOMETRY: return "raw file is smaller than the given geometry";
+    }
+    return "unknown error";
+}
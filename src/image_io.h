@@ -0,0 +1,72 @@
+/* image_io.h  --- inpaintBCT
+ * Copyright (C) 2013 Thomas März (maerz@maths.ox.ac.uk)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef IMAGE_IO_H_
+#define IMAGE_IO_H_
+
+#include <stdio.h>
+
+// Row streaming of 8 bit images for the command line tool. Rows are always
+// interleaved (pixel by pixel), whatever the layout on disk.
+
+enum ImageFormat {FORMAT_NONE,FORMAT_PNG,FORMAT_PAM,FORMAT_RAW};
+
+#define IO_OK 0
+#define IO_ERR_OPEN 1
+#define IO_ERR_FORMAT 2
+#define IO_ERR_DEPTH 3
+#define IO_ERR_READ 4
+#define IO_ERR_WRITE 5
+#define IO_ERR_NO_PNG 6
+#define IO_ERR_GEOMETRY 7
+
+struct ImageFile
+{
+    FILE *fp;
+    int format;
+    int width;
+    int height;
+    int channels; // samples per pixel, including alpha
+    int has_alpha;
+    int writing;
+
+    // raw planar files are read plane by plane
+    long data_offset;
+
+    // libpng state
+    void *png;
+    void *info;
+};
+
+// format from the file name extension: .png, .pam/.pnm/.ppm/.pgm or .raw.
+// FORMAT_PAM is written as PGM/PPM where these can hold the image, and as
+// PAM (P7) for a .pam name or with alpha
+int FormatFromName(const char *filename);
+
+// opens an image for reading, the format is detected from the file contents;
+// files that are neither PNG nor PAM/PNM are read as raw planar data of the
+// given geometry (raw_width <= 0 means no raw input is expected)
+int OpenImageRead(ImageFile *img, const char *filename, int raw_width, int raw_height, int raw_channels);
+int ReadImageRow(ImageFile *img, int y, unsigned char *row);
+
+int OpenImageWrite(ImageFile *img, const char *filename, int format, int width, int height, int channels, int has_alpha);
+int WriteImageRow(ImageFile *img, int y, const unsigned char *row);
+
+int CloseImage(ImageFile *img);
+const char *ImageErrorString(int err);
+
+#endif /* IMAGE_IO_H_ */
@@ -0,0 +1,336 @@
+/* inpainting_comp.cpp  --- inpaintBCT
+ * Copyright (C) 2013 Thomas März (maerz@maths.ox.ac.uk)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Inpainting of the mask component by component.
+ *
+ * A point of the hole reads Image within data->radius and, with guidance,
+ * MImage within lenSK2/2 + 1, where MImage is smoothed and updated within
+ * lenSK1/2. Two hole pixels further apart than the sum of these reaches never
+ * influence each other, and the time field of a pixel only depends on its
+ * own 4-connected part of the hole. So the hole is split into components,
+ * linked through gaps of at most that reach, and every component is inpainted
+ * in its own Data: its bounding box plus a halo of the same reach. The
+ * components run concurrently and only the workspace of the running ones is
+ * allocated.
+ */
+
+#include "inpainting_func.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+#define min(a,b)          ((a)<(b)?(a):(b))
+#define max(a,b)          ((a)>(b)?(a):(b))
+
+#define LABEL_KNOWN   -1
+#define LABEL_NONE     0
+
+struct Component
+{
+    int imin,imax,jmin,jmax;
+    int npoints;
+    int label;
+};
+
+static bool LargerComponent(const Component &a, const Component &b)
+{
+    return a.npoints > b.npoints;
+}
+
+// labels the hole pixels, two pixels get the same label if they are linked by
+// a chain of hole pixels with gaps of at most reach (maximum norm); returns
+// the number of components. Without memory for another component the
+// labelling stops, and the pixels left LABEL_NONE are not inpainted.
+static int LabelComponents(Data *data, int reach, int *label, Component **components)
+{
+    int i,j,yi,yj;
+    int index,yindex;
+    int ncomp = 0;
+    int maxcomp = 16;
+    int top;
+    int interior;
+    int *stack;
+    Component *comp;
+    Component *grown;
+
+    for( index=0 ; index < data->size ; index++ )
+        label[index] = InDomain(data,index) ? LABEL_KNOWN : LABEL_NONE;
+
+    reach = max(reach, 1);
+    stack = (int *) AllocMem(sizeof(int) * data->size);
+    comp = (Component *) malloc(sizeof(Component) * maxcomp);
+    if( (stack == NULL) || (comp == NULL) )
+    {
+        ReportMessage(data, "Out of memory in the labelling of the holes. Nothing is inpainted. \n");
+        FreeMem(stack);
+        free(comp);
+        *components = NULL;
+        return 0;
+    }
+
+    for( index=0 ; index < data->size ; index++ )
+    {
+        if( label[index] != LABEL_NONE )
+            continue;
+
+        if( ncomp == maxcomp )
+        {
+            grown = (Component *) realloc(comp, sizeof(Component) * 2 * maxcomp);
+            if( grown == NULL )
+            {
+                ReportMessage(data, "Out of memory in the labelling of the holes. Only part of the hole is inpainted. \n");
+                break;
+            }
+            comp = grown;
+            maxcomp = 2 * maxcomp;
+        }
+
+        comp[ncomp].label = ncomp + 1;
+        comp[ncomp].npoints = 0;
+        comp[ncomp].imin = data->rows;
+        comp[ncomp].imax = -1;
+        comp[ncomp].jmin = data->cols;
+        comp[ncomp].jmax = -1;
+
+        label[index] = ncomp + 1;
+        stack[0] = index;
+        top = 1;
+
+        while( top > 0 )
+        {
+            yindex = stack[--top];
+            i = PixelRow(data,yindex);
+            j = PixelCol(data,yindex);
+
+            comp[ncomp].npoints++;
+            comp[ncomp].imin = min(comp[ncomp].imin, i);
+            comp[ncomp].imax = max(comp[ncomp].imax, i);
+            comp[ncomp].jmin = min(comp[ncomp].jmin, j);
+            comp[ncomp].jmax = max(comp[ncomp].jmax, j);
+
+            // a gap starts at a boundary pixel of the hole, so only these
+            // have to look at the whole square
+            interior = (i > 0) && (i < data->rows-1) && (j > 0) && (j < data->cols-1);
+            for( yj = j-1 ; interior && (yj <= j+1) ; yj++ )
+                for( yi = i-1 ; yi <= i+1 ; yi++ )
+                    if( label[PixelIndex(data,yi,yj)] == LABEL_KNOWN )
+                        interior = 0;
+
+            for( yj = max(j - (interior ? 1 : reach), 0) ; yj <= min(j + (interior ? 1 : reach), data->cols-1) ; yj++ )
+            {
+                for( yi = max(i - (interior ? 1 : reach), 0) ; yi <= min(i + (interior ? 1 : reach), data->rows-1) ; yi++ )
+                {
+                    if( label[PixelIndex(data,yi,yj)] == LABEL_NONE )
+                    {
+                        label[PixelIndex(data,yi,yj)] = ncomp + 1;
+                        stack[top++] = PixelIndex(data,yi,yj);
+                    }
+                }
+            }
+        }
+        ncomp++;
+    }
+
+    FreeMem(stack);
+    *components = comp;
+    return ncomp;
+}
+
+// inpaints one component in a Data of its own and copies its pixels back;
+// returns its inpaint_undefined
+static int InpaintComponent(Data *data, Component *comp, int *label, int halo, int threads)
+{
+    Data sub;
+    int i0,i1,j0,j1;
+    int i,j,c;
+    int index,sindex;
+    int known;
+    int undefined;
+
+    i0 = max(comp->imin - halo, 0);
+    i1 = min(comp->imax + halo, data->rows-1);
+    j0 = max(comp->jmin - halo, 0);
+    j1 = min(comp->jmax + halo, data->cols-1);
+
+    SetDefaults(&sub);
+    sub.rows = i1 - i0 + 1;
+    sub.cols = j1 - j0 + 1;
+    sub.xmin = data->xmin + j0;
+    sub.ymin = data->ymin + i0;
+    sub.xmax = sub.xmin + sub.cols;
+    sub.ymax = sub.ymin + sub.rows;
+    sub.channels = data->channels;
+    sub.layout = data->layout;
+
+    sub.epsilon = data->epsilon;
+    sub.radius = data->radius;
+    sub.kappa = data->kappa;
+    sub.sigma = data->sigma;
+    sub.rho = data->rho;
+    sub.thresh = data->thresh;
+    sub.delta_quant4 = data->delta_quant4;
+    sub.guidance = data->guidance;
+    sub.marching = data->marching;
+    sub.threads = threads;
+    sub.tband = data->tband;
+    sub.scheduler = data->scheduler;
+    sub.smoothing = data->smoothing;
+    sub.precision = data->precision;
+    sub.cutoff = data->cutoff;
+    sub.nearfield = data->nearfield;
+    sub.message = data->message;
+    sub.callback_data = data->callback_data;
+
+    // NULL weights the channels alike, see GradientTensor
+    if( data->convex != NULL )
+    {
+        sub.convex = (double *) AllocMem(sizeof(double) * data->channels);
+        memcpy(sub.convex, data->convex, sizeof(double) * data->channels);
+    }
+
+    AllocBuffers(&sub);
+
+    // same contents as SetImageRow; hole pixels of other components in the
+    // halo are inpainted as well, but their values are not copied back
+    for( i=0 ; i < sub.rows ; i++ )
+    {
+        for( j=0 ; j < sub.cols ; j++ )
+        {
+            index = PixelIndex(data, i + i0, j + j0);
+            sindex = PixelIndex(&sub,i,j);
+
+            known = InDomain(data,index);
+            SetDomain(&sub,sindex,known);
+            sub.MDomain[sindex] = known;
+
+            if( !known )
+            {
+                sub.ordered_points[sub.nof_points2inpaint*3] = i;
+                sub.ordered_points[sub.nof_points2inpaint*3+1] = j;
+                sub.ordered_points[sub.nof_points2inpaint*3+2] = -1;
+                sub.inpaint_index[sindex] = sub.nof_points2inpaint;
+                sub.nof_points2inpaint = sub.nof_points2inpaint + 1;
+            }
+
+            for( c=0 ; c < sub.channels ; c++ )
+            {
+                sub.Image[SampleIndex(&sub,sindex,c)] = known ? data->Image[SampleIndex(data,index,c)] : 0;
+                sub.MImage[SampleIndex(&sub,sindex,c)] = sub.Image[SampleIndex(&sub,sindex,c)];
+            }
+        }
+    }
+
+    if( sub.guidance == 1 )
+        SetKernels(&sub);
+
+    InpaintImage(&sub);
+
+    for( i = comp->imin ; i <= comp->imax ; i++ )
+    {
+        for( j = comp->jmin ; j <= comp->jmax ; j++ )
+        {
+            index = PixelIndex(data,i,j);
+            if( label[index] != comp->label )
+                continue;
+
+            sindex = PixelIndex(&sub, i - i0, j - j0);
+            for( c=0 ; c < data->channels ; c++ )
+                data->Image[SampleIndex(data,index,c)] = sub.Image[SampleIndex(&sub,sindex,c)];
+        }
+    }
+
+    undefined = sub.inpaint_undefined;
+    // the components may run concurrently
+    #pragma omp critical
+    {
+        if( sub.order_deviation > data->order_deviation )
+            data->order_deviation = sub.order_deviation;
+    }
+
+    ClearMemory(&sub);
+    return undefined;
+}
+
+// Inpaints the hole of data component by component. Only Image and Domain
+// (AllocImage and SetImageRow) and the kernels are needed; a given order or
+// guidance refers to the whole Data and is handed to InpaintImage, which
+// needs AllocBuffers.
+void InpaintComponents(Data *data)
+{
+    int s,r;
+    int reach;
+    int ncomp,k;
+    int nthreads;
+    int large;
+    int undefined = 0;
+    long total,done;
+    int *label;
+    Component *comp;
+
+    if( (data->ordergiven != 0) || (data->GivenGuidanceT != NULL) )
+    {
+        InpaintImage(data);
+        return;
+    }
+
+    // reach of a point, see InpaintByWaves
+    s = (data->guidance == 1 && data->SKernel1 != NULL) ? (data->lenSK1-1)/2 : 0;
+    r = (data->guidance == 1) ? (data->lenSK2-1)/2 + 1 : 0;
+    reach = max(data->radius, r + s);
+
+    label = (int *) AllocMem(sizeof(int) * data->size);
+    ncomp = LabelComponents(data, reach, label, &comp);
+
+    // the largest components first, for the load balance
+    std::sort(comp, comp + ncomp, LargerComponent);
+
+    total = 0;
+    for( k=0 ; k < ncomp ; k++ )
+        total += comp[k].npoints;
+
+    // a component with more than its share of the points gets all threads,
+    // the others are inpainted side by side with one thread each
+    nthreads = NumThreads(data);
+    for( large=0 ; (large < ncomp) && (nthreads > 1) && ((long) comp[large].npoints * nthreads > total) ; large++ );
+
+    done = 0;
+    for( k=0 ; k < large ; k++ )
+    {
+        undefined |= InpaintComponent(data, &comp[k], label, reach, nthreads);
+        done += comp[k].npoints;
+        ReportProgress(data, (double) done / (double) total);
+    }
+
+    #pragma omp parallel for schedule(dynamic,1) num_threads(nthreads) if( ncomp - large > 1 ) reduction(|:undefined)
+    for( k=large ; k < ncomp ; k++ )
+    {
+        undefined |= InpaintComponent(data, &comp[k], label, reach, 1);
+
+        #pragma omp atomic
+        done += comp[k].npoints;
+
+        if( ThreadNum() == 0 )
+            ReportProgress(data, (double) done / (double) total);
+    }
+
+    if( undefined )
+        data->inpaint_undefined = 1;
+
+    free(comp);
+    FreeMem(label);
+}
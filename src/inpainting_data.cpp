@@ -0,0 +1,436 @@
+/* inpainting_data.cpp  --- inpaintBCT
+ * Copyright (C) 2013 Thomas März (maerz@maths.ox.ac.uk)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "inpainting_func.h"
+
+#include <cstdlib>
+#include <algorithm>
+
+
+void *AllocMem(size_t n)
+{
+	void *p;
+	p = malloc( n );
+	return p;
+}
+
+void FreeMem(void* p)
+{
+	free(p);
+}
+
+void SetDefaults(Data *data)
+{
+    data->rows = 1;
+    data->cols = 1;
+    data->channels = 1;
+    data->size = 1;
+    data->layout = LAYOUT_PLANAR;
+    data->istride = 1;
+    data->jstride = 1;
+    data->pstride = 1;
+    data->cstride = 1;
+    data->Image = NULL;
+    data->MImage = NULL;
+    data->ImageQ = NULL;
+    data->GradT = NULL;
+    data->RowT = NULL;
+
+
+
+    // default parameters
+    data->epsilon = 5;
+    data->radius = 5;
+    data->kappa = 25;
+    data->sigma = 1.414213562373095; // sqrt(2.0);
+    data->rho = 5;
+    data->thresh = 0;
+    data->delta_quant4 = 1; // default quantization range is [0,255]
+
+    data->convex = NULL;
+
+
+    data->ordered_points = NULL;
+    data->inpaint_index = NULL;
+    data->nof_points2inpaint = 0;
+    data->Tfield = NULL;
+    data->Flag = NULL;
+    data->hpos = NULL;
+    data->Known = NULL;
+    data->Domain = NULL;
+    data->MDomain = NULL;
+    data->GivenGuidanceT = NULL;
+
+    data->lenSK1 = 0;
+    data->lenSK2 = 0;
+    data->SKernel1 = NULL;
+    data->SKernel2 = NULL;
+    data->Ihelp = NULL;
+
+    data->lenStencil = 0;
+    data->radiusStencil = 0;
+    data->StencilRow = NULL;
+    data->StencilI = NULL;
+    data->StencilJ = NULL;
+    data->StencilR = NULL;
+
+    data->ordergiven = 0;
+    data->guidance = 1;
+    data->marching = MARCHING_EXACT;
+
+    data->inpaint_undefined = 0;
+    data->order_deviation = 0;
+
+    data->threads = 0;
+    data->tband = 0;
+    data->scheduler = SCHEDULE_LEVELS;
+    data->smoothing = SMOOTHING_FIR;
+    data->precision = PRECISION_EXACT;
+    data->cutoff = 0;
+    data->nearfield = 0;
+    data->levels = 0;
+    data->Pyramid = NULL;
+
+    data->progress = NULL;
+    data->message = NULL;
+    data->stage = NULL;
+    data->callback_data = NULL;
+}
+
+// allocates the image and domain buffers for rows x cols x channels in
+// data->layout, enough
+// for InpaintComponents; the pixel values are transferred row by row with
+// SetImageRow
+void AllocImage(Data *data)
+{
+    data->size = data->rows * data->cols;
+
+    if( data->layout == LAYOUT_INTERLEAVED )
+    {
+        data->istride = data->cols;
+        data->jstride = 1;
+        data->pstride = data->channels;
+        data->cstride = 1;
+    }
+    else
+    {
+        data->istride = 1;
+        data->jstride = data->rows;
+        data->pstride = 1;
+        data->cstride = data->size;
+    }
+
+    data->Image = (Real *) AllocMem(sizeof(Real) * data->size * data->channels);
+    data->Domain = (unsigned int *) AllocMem(sizeof(unsigned int) * DOMAIN_WORDS(data->size));
+
+    data->nof_points2inpaint = 0;
+}
+
+// allocates the image, domain and time buffers for rows x cols x channels,
+// everything InpaintImage works on
+void AllocBuffers(Data *data)
+{
+    AllocImage(data);
+
+    data->MImage = (Real *) AllocMem(sizeof(Real) * data->size * data->channels);
+
+    data->Ihelp = (Real *) AllocMem(sizeof(Real) * data->channels);
+    data->Tfield = (Real *) AllocMem(sizeof(Real) * data->size);
+    data->Flag = (unsigned char *) AllocMem(sizeof(unsigned char) * data->size);
+    data->hpos = (int *) AllocMem(sizeof(int) * data->size);
+    data->MDomain = (Real *) AllocMem(sizeof(Real) * data->size);
+    data->ordered_points = (Real *) AllocMem(sizeof(Real) * data->size *3);
+    data->inpaint_index = (int *) AllocMem(sizeof(int) * data->size);
+}
+
+// copies row i of an interleaved 8 bit image and mask into the data buffers,
+// a pixel is to be inpainted if its first mask channel is nonzero
+void SetImageRow(Data *data, int i, const unsigned char *pixel, int image_channels, const unsigned char *mpixel, int mask_channels)
+{
+    int j,k,l,c;
+    int index;
+    int sindex;
+
+    for( j=0, k=0, l=0 ; j < data->cols ; j++ , k+=image_channels, l+=mask_channels)
+    {
+        index = PixelIndex(data,i,j);
+        sindex = SampleIndex(data,index,0);
+
+        if( mpixel[l] ) // INSIDE
+        {
+            if( data->ordered_points != NULL )
+            {
+                data->ordered_points[data->nof_points2inpaint*3] = i;
+                data->ordered_points[data->nof_points2inpaint*3+1] = j;
+                data->ordered_points[data->nof_points2inpaint*3+2] = -1;
+                data->inpaint_index[index] = data->nof_points2inpaint;
+            }
+            data->nof_points2inpaint = data->nof_points2inpaint + 1;
+            SetDomain(data, index, 0);
+
+            for( c=0 ; c < data->channels ; c++ )
+                data->Image[sindex + c*data->cstride] = 0;
+        }
+        else // OUTSIDE
+        {
+            SetDomain(data, index, 1);
+
+            for( c=0 ; c < data->channels ; c++ )
+                data->Image[sindex + c*data->cstride] = (Real) (pixel[c + k]);
+        }
+
+        // the working copies exist only after AllocBuffers
+        if( data->MImage != NULL )
+        {
+            data->MDomain[index] = InDomain(data, index);
+            for( c=0 ; c < data->channels ; c++ )
+                data->MImage[sindex + c*data->cstride] = data->Image[sindex + c*data->cstride];
+        }
+    }
+}
+
+// copies row i of the image buffer into an interleaved 8 bit row,
+// channels beyond data->channels (e.g. alpha) are left untouched
+void GetImageRow(Data *data, int i, unsigned char *pixel, int image_channels)
+{
+    int j,k,c;
+    int sindex;
+
+    for( j=0, k=0 ; j < data->cols ; j++ , k+=image_channels)
+    {
+        sindex = SampleIndex(data,PixelIndex(data,i,j),0);
+        for( c=0 ; c < data->channels ; c++ )
+            pixel[k + c] = (unsigned char) (data->Image[sindex + c*data->cstride]);
+    }
+}
+
+void SetKernels(Data *data)
+{
+    int i;
+	int s;
+	int r;
+
+	s = std::max( int(round(2 * data->sigma)) , 1 );
+	r = std::max( int(round(2 * data->rho)) , 1 );
+	data->lenSK1 = 2*s +1;
+	data->lenSK2 = 2*r +1;
+
+
+    if( data->sigma > 0 )
+    {
+        data->SKernel1 = (Real *) AllocMem(sizeof(Real) * data->lenSK1);
+        for( i=0 ; i < data->lenSK1 ; i++)
+            data->SKernel1[i] = exp( -((i-s)*(i-s))/(2* data->sigma * data->sigma) );
+    }
+
+    data->SKernel2 = (Real *) AllocMem(sizeof(Real) * data->lenSK2);
+    for( i=0 ; i < data->lenSK2 ; i++)
+        data->SKernel2[i] = exp( -((i-r)*(i-r))/(2* data->rho * data->rho) );
+
+    SetStencil(data);
+}
+
+static void ClearStencil(Data *data)
+{
+    FreeMem( data->StencilI );
+    FreeMem( data->StencilJ );
+    FreeMem( data->StencilR );
+    FreeMem( data->StencilRow );
+    data->StencilI = NULL;
+    data->StencilJ = NULL;
+    data->StencilR = NULL;
+    data->StencilRow = NULL;
+    data->lenStencil = 0;
+    data->radiusStencil = 0;
+}
+
+void SetStencil(Data *data)
+{
+    int vi,vj;
+    int k;
+    int n = 2 * data->radius + 1;
+    Real r;
+
+    if( data->StencilI != NULL )
+    {
+        if( data->radiusStencil == data->radius )
+            return;
+        ClearStencil(data);
+    }
+
+    data->StencilI = (int *) AllocMem(sizeof(int) * n * n);
+    data->StencilJ = (int *) AllocMem(sizeof(int) * n * n);
+    data->StencilR = (Real *) AllocMem(sizeof(Real) * n * n);
+    data->StencilRow = (int *) AllocMem(sizeof(int) * (n + 1));
+
+    k = 0;
+    for( vi = -data->radius ; vi <= data->radius ; vi++ )
+    {
+        data->StencilRow[vi + data->radius] = k;
+        for( vj = -data->radius ; vj <= data->radius ; vj++ )
+        {
+            r = sqrt( (Real) (vi*vi + vj*vj) );
+            if( (r == 0) || (r > data->radius) )
+                continue;
+
+            data->StencilI[k] = vi;
+            data->StencilJ[k] = vj;
+            data->StencilR[k] = r;
+            k++;
+        }
+    }
+    data->StencilRow[n] = k;
+    data->lenStencil = k;
+    data->radiusStencil = data->radius;
+}
+
+void ClearMemory(Data *data)
+{
+    int i;
+
+	if( data->Image != NULL )
+	{
+		FreeMem( data->Image );
+		data->Image = NULL;
+	}
+
+	if( data->MImage != NULL )
+	{
+		FreeMem( data->MImage );
+		data->MImage = NULL;
+	}
+
+    if( data->ImageQ != NULL )
+    {
+        FreeMem( data->ImageQ );
+        data->ImageQ = NULL;
+    }
+
+    if( data->GradT != NULL )
+    {
+        FreeMem( data->GradT );
+        data->GradT = NULL;
+    }
+
+    if( data->RowT != NULL )
+    {
+        FreeMem( data->RowT );
+        data->RowT = NULL;
+    }
+
+    if( data->Domain != NULL )
+    {
+        FreeMem( data->Domain );
+        data->Domain = NULL;
+    }
+
+    if( data->MDomain != NULL )
+    {
+        FreeMem( data->MDomain );
+        data->MDomain = NULL;
+    }
+
+    if( data->Tfield != NULL )
+    {
+        FreeMem( data->Tfield );
+        data->Tfield = NULL;
+    }
+
+    if( data->Flag != NULL )
+    {
+        FreeMem( data->Flag );
+        data->Flag = NULL;
+    }
+
+    if( data->hpos != NULL )
+    {
+        FreeMem( data->hpos );
+        data->hpos = NULL;
+    }
+
+    if( data->Known != NULL )
+    {
+        FreeMem( data->Known );
+        data->Known = NULL;
+    }
+
+    if( data->Pyramid != NULL )
+    {
+        for( i=1 ; i <= data->levels ; i++ )
+            FreeMem( data->Pyramid[i] );
+        FreeMem( data->Pyramid );
+        data->Pyramid = NULL;
+    }
+
+    if( data->Ihelp != NULL )
+    {
+        FreeMem( data->Ihelp );
+        data->Ihelp = NULL;
+    }
+
+    if( data->convex != NULL )
+    {
+        FreeMem( data->convex );
+        data->convex = NULL;
+    }
+
+    if( data->SKernel1 != NULL )
+    {
+        FreeMem( data->SKernel1 );
+        data->SKernel1 = NULL;
+    }
+
+    if( data->SKernel2 != NULL )
+    {
+        FreeMem( data->SKernel2 );
+        data->SKernel2 = NULL;
+    }
+
+    if( data->StencilI != NULL )
+        ClearStencil(data);
+
+    if( data->ordered_points != NULL )
+    {
+        FreeMem( data->ordered_points );
+        data->ordered_points = NULL;
+    }
+
+    if( data->inpaint_index != NULL )
+    {
+    	FreeMem( data->inpaint_index );
+    	data->inpaint_index = NULL;
+    }
+}
+
+// callbacks
+void ReportProgress(Data *data, double fraction)
+{
+    if( data->progress != NULL )
+        data->progress(fraction, data->callback_data);
+}
+
+void ReportMessage(Data *data, const char *message)
+{
+    if( data->message != NULL )
+        data->message(message, data->callback_data);
+}
+
+void ReportStage(Data *data, int stage, int points)
+{
+    if( data->stage != NULL )
+        data->stage(stage, points, data->callback_data);
+}
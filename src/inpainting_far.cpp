@@ -0,0 +1,275 @@
+/* inpainting_far.cpp  --- inpaintBCT
+ * Copyright (C) 2013 Thomas März (maerz@maths.ox.ac.uk)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Far field approximation of inpaintPoint.
+ *
+ * With 0 < data->nearfield < data->radius, inpaintPoint weights the known
+ * neighbours within nearfield exactly and takes the ones further out from a
+ * pyramid of sums over the known pixels: level L has a cell per square of
+ * 2^L x 2^L pixels, holding their number, the sums of their rows and columns
+ * and of their image values. A cell that is small compared to its distance
+ * to the point gets the weight of the centroid of its known pixels for all
+ * of them; other cells are split into their four children, down to single
+ * pixels. Where the weights are smooth the work per point grows with
+ * log(radius) instead of radius^2; along a thin ellipse of guidance it
+ * stays closer to the exact scan.
+ *
+ * A pixel enters the pyramid when it becomes KNOWN, see MarkKnown. The cells
+ * cover pixels well beyond the reach of a point, so the waves of
+ * InpaintByWaves would read cells while they change; InpaintByOrder runs the
+ * levels instead.
+ */
+
+#include "inpainting_func.h"
+
+#include <cstring>
+
+#define min(a,b)          ((a)<(b)?(a):(b))
+#define max(a,b)          ((a)>(b)?(a):(b))
+
+// a cell is taken as a whole if its size is at most this times its distance
+// and, with guidance, z varies by at most FAR_DZ over it or is above
+// FAR_ZMAX all over it
+#define FAR_OPENING 0.5
+#define FAR_DZ      1
+#define FAR_ZMAX    20
+
+// number, sum of rows and of columns, and the sum of every channel
+#define CELL_LEN(data)    (3 + (data)->channels)
+
+static int PyramidRows(Data *data, int L)
+{
+    return (data->rows + (1 << L) - 1) >> L;
+}
+
+static int PyramidCols(Data *data, int L)
+{
+    return (data->cols + (1 << L) - 1) >> L;
+}
+
+// allocates and clears the pyramid if the far field is used; the levels go
+// up to cells of FAR_OPENING * radius, larger ones are never taken as a whole
+void InitPyramid(Data *data)
+{
+    int L;
+
+    if( (data->nearfield <= 0) || (data->nearfield >= data->radius) )
+        return;
+
+    if( data->Pyramid == NULL )
+    {
+        for( data->levels = 1 ; (2 << data->levels) <= FAR_OPENING * data->radius ; data->levels++ );
+
+        data->Pyramid = (Real **) AllocMem(sizeof(Real *) * (data->levels + 1));
+        data->Pyramid[0] = NULL; // level 0 are the pixels themselves
+        for( L=1 ; L <= data->levels ; L++ )
+            data->Pyramid[L] = (Real *) AllocMem(sizeof(Real) * PyramidRows(data,L) * PyramidCols(data,L) * CELL_LEN(data));
+    }
+
+    for( L=1 ; L <= data->levels ; L++ )
+        memset(data->Pyramid[L], 0, sizeof(Real) * PyramidRows(data,L) * PyramidCols(data,L) * CELL_LEN(data));
+}
+
+// adds the known pixel (i,j) to the cells above it
+void AddToPyramid(Data *data, int i, int j)
+{
+    int L,c;
+    int sindex = SampleIndex(data,PixelIndex(data,i,j),0);
+    Real *cell;
+
+    for( L=1 ; L <= data->levels ; L++ )
+    {
+        cell = data->Pyramid[L] + ((i >> L) * PyramidCols(data,L) + (j >> L)) * CELL_LEN(data);
+        cell[0] += 1;
+        cell[1] += i;
+        cell[2] += j;
+        for( c=0 ; c < data->channels ; c++ )
+            cell[3 + c] += data->Image[sindex + c * data->cstride];
+    }
+}
+
+// n pixels at the offset (vi,vj) with the image sums sum[c * stride], with
+// the weights and the insurance of AccumulateBlock
+static void FarAdd(Data *data, const double *G, Real zfac, double vi, double vj, Real n, const Real *sum, int stride, Real *Ihelp, Real *W, Real *Wk, Real *scale)
+{
+    int c;
+    double z;
+    Real w;
+    Real fixed = 1;
+
+    if( data->guidance != 0 )
+    {
+        z = zfac * (G[0]*vi*vi + 2*G[1]*vi*vj + G[2]*vj*vj);
+        if( data->precision != PRECISION_EXACT )
+            w = FastExp(-z * 0.5) / sqrt(vi*vi + vj*vj);
+        else
+            w = exp(-z * 0.5) / sqrt(vi*vi + vj*vj);
+    }
+    else
+        w = 1 / sqrt(vi*vi + vj*vj);
+
+    *Wk = *Wk + n * w;
+    if( data->precision == PRECISION_FIXED )
+    {
+        // as in AccumulateBlock, with the sums over ImageQ
+        FixedRescale(data, w, scale, Ihelp, W);
+        w = 1 + FIXED_WSCALE * FixedFraction(*scale, w);
+        fixed = 1 << FIXED_SHIFT;
+    }
+    else
+        w = 1 + (1.844674407370955e+19 * w); // insurance
+    *W = *W + n * w;
+
+    for( c=0 ; c < data->channels ; c++ )
+        Ihelp[c] = Ihelp[c] + w * fixed * sum[c * stride];
+}
+
+// the weights of the offsets vi0..vi1 x vj0..vj1 of a cell are close to the
+// weight of its centroid: z varies by at most FAR_DZ, or is above FAR_ZMAX
+static int Aggregable(Data *data, const double *G, Real zfac, int vi0, int vi1, int vj0, int vj1)
+{
+    int k;
+    double vi[4] = {(double) vi0, (double) vi0, (double) vi1, (double) vi1};
+    double vj[4] = {(double) vj0, (double) vj1, (double) vj1, (double) vj0};
+    double gi[4],gj[4],z[4];
+    double zmin,zmax;
+    double d0,d1,a;
+
+    if( data->guidance == 0 )
+        return 1;
+
+    // z at the corners, in turn, and half its gradient Gv
+    for( k=0 ; k < 4 ; k++ )
+    {
+        gi[k] = G[0]*vi[k] + G[1]*vj[k];
+        gj[k] = G[1]*vi[k] + G[2]*vj[k];
+        z[k] = vi[k]*gi[k] + vj[k]*gj[k];
+    }
+
+    // z is a quadratic form: largest at a corner, smallest at a corner or
+    // inside an edge where its derivative along the edge changes sign
+    zmin = min(min(z[0],z[1]),min(z[2],z[3]));
+    zmax = max(max(z[0],z[1]),max(z[2],z[3]));
+    for( k=0 ; k < 4 ; k++ )
+    {
+        d0 = (vi[(k+1)&3] - vi[k]) * gi[k] + (vj[(k+1)&3] - vj[k]) * gj[k];
+        d1 = (vi[(k+1)&3] - vi[k]) * gi[(k+1)&3] + (vj[(k+1)&3] - vj[k]) * gj[(k+1)&3];
+        a = d1 - d0; // e'Ge
+        if( (d0 < 0) && (d1 > 0) )
+            zmin = min(zmin, z[k] - d0*d0/a);
+    }
+    zmin = zfac * zmin;
+    zmax = zfac * zmax;
+
+    return (zmax - zmin <= FAR_DZ) || (zmin >= FAR_ZMAX);
+}
+
+// the known pixels of rows i0..i1 and columns j0..j1 beyond nearfield and
+// within radius of (xi,xj), one by one
+static void FarPixels(Data *data, int i0, int i1, int j0, int j1, int xi, int xj, const double *G, Real zfac, Real Tx, Real *Ihelp, Real *W, Real *Wk, Real *scale)
+{
+    int i,j;
+    int d2;
+    int b,index;
+    int near2 = data->nearfield * data->nearfield;
+    int radius2 = data->radius * data->radius;
+
+    for( i=i0 ; i <= i1 ; i++ )
+    {
+        for( j=j0 ; j <= j1 ; j++ )
+        {
+            d2 = (i-xi)*(i-xi) + (j-xj)*(j-xj);
+            b = KnownBit(data,i,j);
+            if( (d2 <= near2) || (d2 > radius2) || !((data->Known[b >> 5] >> (b & 31)) & 1) )
+                continue;
+
+            index = PixelIndex(data,i,j);
+            if( data->Tfield[index] == Tx )
+                continue;
+
+            FarAdd(data, G, zfac, i - xi, j - xj, 1, data->Image + SampleIndex(data,index,0), data->cstride, Ihelp, W, Wk, scale);
+        }
+    }
+}
+
+// the known pixels of cell (ci,cj) of level L beyond nearfield and within
+// radius of (xi,xj)
+static void FarCell(Data *data, int L, int ci, int cj, int xi, int xj, const double *G, Real zfac, Real Tx, Real *Ihelp, Real *W, Real *Wk, Real *scale)
+{
+    int i0,i1,j0,j1;
+    int di,dj;
+    int dmin2,dmax2;
+    int near2 = data->nearfield * data->nearfield;
+    int radius2 = data->radius * data->radius;
+    double vi,vj;
+    Real *cell;
+
+    i0 = ci << L;
+    j0 = cj << L;
+    if( (i0 >= data->rows) || (j0 >= data->cols) )
+        return;
+    i1 = min(i0 + (1 << L), data->rows) - 1;
+    j1 = min(j0 + (1 << L), data->cols) - 1;
+
+    // nearest and farthest pixel of the cell
+    di = max(max(i0 - xi, xi - i1), 0);
+    dj = max(max(j0 - xj, xj - j1), 0);
+    dmin2 = di*di + dj*dj;
+    di = max(xi - i0, i1 - xi);
+    dj = max(xj - j0, j1 - xj);
+    dmax2 = di*di + dj*dj;
+
+    if( (dmin2 > radius2) || (dmax2 <= near2) )
+        return;
+
+    cell = data->Pyramid[L] + (ci * PyramidCols(data,L) + cj) * CELL_LEN(data);
+    if( cell[0] == 0 )
+        return;
+
+    vi = cell[1]/cell[0] - xi;
+    vj = cell[2]/cell[0] - xj;
+    if( (dmin2 > near2) && (dmax2 <= radius2) && ((1 << L) <= FAR_OPENING * sqrt((double) dmin2))
+        && Aggregable(data, G, zfac, i0 - xi, i1 - xi, j0 - xj, j1 - xj) )
+    {
+        FarAdd(data, G, zfac, vi, vj, cell[0], cell + 3, 1, Ihelp, W, Wk, scale);
+        return;
+    }
+
+    if( L == 1 )
+    {
+        FarPixels(data, i0, i1, j0, j1, xi, xj, G, zfac, Tx, Ihelp, W, Wk, scale);
+        return;
+    }
+
+    FarCell(data, L-1, 2*ci,   2*cj,   xi, xj, G, zfac, Tx, Ihelp, W, Wk, scale);
+    FarCell(data, L-1, 2*ci,   2*cj+1, xi, xj, G, zfac, Tx, Ihelp, W, Wk, scale);
+    FarCell(data, L-1, 2*ci+1, 2*cj,   xi, xj, G, zfac, Tx, Ihelp, W, Wk, scale);
+    FarCell(data, L-1, 2*ci+1, 2*cj+1, xi, xj, G, zfac, Tx, Ihelp, W, Wk, scale);
+}
+
+// adds the known neighbours of (xi,xj) beyond nearfield to the sums of
+// inpaintPoint
+void FarField(Data *data, int xi, int xj, const double *G, Real zfac, Real *Ihelp, Real *W, Real *Wk, Real *scale)
+{
+    int L = data->levels;
+    int ci,cj;
+    Real Tx = data->Tfield[PixelIndex(data,xi,xj)];
+
+    for( ci = max(xi - data->radius, 0) >> L ; ci <= (min(xi + data->radius, data->rows-1) >> L) ; ci++ )
+        for( cj = max(xj - data->radius, 0) >> L ; cj <= (min(xj + data->radius, data->cols-1) >> L) ; cj++ )
+            FarCell(data, L, ci, cj, xi, xj, G, zfac, Tx, Ihelp, W, Wk, scale);
+}
@@ -18,8 +18,11 @@
 #include "inpainting_func.h"
 
 #include <cstdlib>
-#include <gtk/gtk.h>
-#include <libgimp/gimp.h>
+#include <cstring>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 
 #define Inf               std::numeric_limits<double>::infinity()
@@ -28,6 +31,116 @@
 #define round(a)	      (int)((a) + 0.5)
 #define sign(a)		      ((a) > 0 ? 1 : ((a) < 0 ? -1 : 0))
 
+// levels with fewer points are inpainted by one thread
+#define PARALLEL_MIN_POINTS 64
+
+// neighbours of inpaintPoint are weighted in blocks of this size
+#define STENCIL_BLOCK 16
+
+// SmoothImage works on tiles of this many pixels of a plane
+#define SMOOTH_TILE_ROWS 128
+#define SMOOTH_TILE_COLS 64
+
+
+// position of the lowest and of the highest set bit of x != 0
+static inline int LowestBit(unsigned int x)
+{
+#ifdef __GNUC__
+    return __builtin_ctz(x);
+#else
+    int n = 0;
+    for( ; !(x & 1) ; x >>= 1 )
+        n++;
+    return n;
+#endif
+}
+
+static inline int HighestBit(unsigned int x)
+{
+#ifdef __GNUC__
+    return 31 - __builtin_clz(x);
+#else
+    int n = 0;
+    for( ; x > 1 ; x >>= 1 )
+        n++;
+    return n;
+#endif
+}
+
+// v in [0,255] as a 16 bit fixed point value
+static inline short FixedValue(Real v)
+{
+    v = min(max(v, 0), 255);
+    return (short) (v * (1 << FIXED_SHIFT) + 0.5);
+}
+
+// word w of Known, every pixel counts as known before InitKnown
+static inline unsigned int KnownWord(const Data *data, int w)
+{
+    return (data->Known != NULL) ? data->Known[w] : ~0u;
+}
+
+// first bit in b..b1 of Known that equals v, b1+1 if there is none
+static inline int ScanKnownUp(const Data *data, int b, int b1, int v)
+{
+    unsigned int flip = v ? 0 : ~0u;
+    unsigned int bits;
+    int w = b >> 5;
+
+    if( b > b1 )
+        return b1 + 1;
+
+    bits = (KnownWord(data,w) ^ flip) & (~0u << (b & 31));
+    while( bits == 0 )
+    {
+        if( ++w > (b1 >> 5) )
+            return b1 + 1;
+        bits = KnownWord(data,w) ^ flip;
+    }
+    return min((w << 5) + LowestBit(bits), b1 + 1);
+}
+
+// last bit in b0..b of Known that equals v, b0-1 if there is none
+static inline int ScanKnownDown(const Data *data, int b, int b0, int v)
+{
+    unsigned int flip = v ? 0 : ~0u;
+    unsigned int bits;
+    int w = b >> 5;
+
+    if( b < b0 )
+        return b0 - 1;
+
+    bits = (KnownWord(data,w) ^ flip) & (~0u >> (31 - (b & 31)));
+    while( bits == 0 )
+    {
+        if( --w < (b0 >> 5) )
+            return b0 - 1;
+        bits = KnownWord(data,w) ^ flip;
+    }
+    return max((w << 5) + HighestBit(bits), b0 - 1);
+}
+
+
+int NumThreads(Data *data)
+{
+#ifdef _OPENMP
+    if( data->threads > 0 )
+        return data->threads;
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+
+int ThreadNum(void)
+{
+#ifdef _OPENMP
+    return omp_get_thread_num();
+#else
+    return 0;
+#endif
+}
+
 
 void InpaintImage(Data *data)
 {    
@@ -41,7 +154,7 @@ void InpaintImage(Data *data)
     {
         int i;
         for(i=0 ; i < data->size ; i++ )
-            if(data->Tfield[i].T == 0)
+            if(data->Tfield[i] == 0)
                 data->Image[i] = 255;
     }
     //*/
@@ -49,135 +162,749 @@ void InpaintImage(Data *data)
 
 
 // Smoothing
-void SmoothImage(Data *data)
+
+// sample of plane c at pixel (i,j), zero outside the image; plane
+// data->channels is the domain
+static inline Real PlaneSample(Data *data, int c, int i, int j)
 {
-	int i,j,c,ri;
-	int p,h,ph;
-	int s;
-    int size;
+    if( (i < 0) || (i >= data->rows) || (j < 0) || (j >= data->cols) )
+        return 0;
+    if( c == data->channels )
+        return InDomain(data,PixelIndex(data,i,j));
+    return data->Image[SampleIndex(data,PixelIndex(data,i,j),c)];
+}
+
+// sets plane c of MImage at pixel (i,j) to v, the domain plane in MDomain
+static inline void SetPlaneSample(Data *data, int c, int i, int j, Real v)
+{
+    if( c == data->channels )
+        data->MDomain[PixelIndex(data,i,j)] = v;
+    else
+        data->MImage[SampleIndex(data,PixelIndex(data,i,j),c)] = v;
+}
+
+// MImage and MDomain are read within this of a hole pixel: by
+// ModStructureTensor, through GradientTensor, within lenSK2/2 + 1 and by
+// TfieldAdaptInitializationToImage within 1. SmoothImage only smooths
+// around the hole; elsewhere they keep the copy of the image made by
+// SetImageRow, and what SmoothUpdate splats there is never read.
+static int SmoothReach(Data *data)
+{
+    if( data->SKernel2 == NULL )
+        return data->rows + data->cols;
+    return (data->lenSK2 - 1)/2 + 1;
+}
+
+// flags the tiles of SmoothImage with a pixel within reach (maximum norm)
+// of the hole, from the bounding boxes of the hole pixels of every tile
+static void BandTiles(Data *data, int reach, int tiles_i, int tiles_j, unsigned char *band)
+{
+    int i,j,t;
+    int ti,tj;
+    int *box = (int *) AllocMem(sizeof(int) * 4 * tiles_i * tiles_j);
+
+    for( t=0 ; t < tiles_i * tiles_j ; t++ )
+    {
+        box[4*t] = data->rows;
+        box[4*t+1] = -1;
+        box[4*t+2] = data->cols;
+        box[4*t+3] = -1;
+        band[t] = 0;
+    }
+
+    for( i=0 ; i < data->rows ; i++ )
+        for( j=0 ; j < data->cols ; j++ )
+            if( !InDomain(data,PixelIndex(data,i,j)) )
+            {
+                t = (i / SMOOTH_TILE_ROWS) * tiles_j + j / SMOOTH_TILE_COLS;
+                box[4*t] = min(box[4*t], i);
+                box[4*t+1] = max(box[4*t+1], i);
+                box[4*t+2] = min(box[4*t+2], j);
+                box[4*t+3] = max(box[4*t+3], j);
+            }
+
+    for( t=0 ; t < tiles_i * tiles_j ; t++ )
+    {
+        if( box[4*t+1] < 0 )
+            continue;
+        for( ti = max(box[4*t] - reach, 0) / SMOOTH_TILE_ROWS ; ti <= min(box[4*t+1] + reach, data->rows-1) / SMOOTH_TILE_ROWS ; ti++ )
+            for( tj = max(box[4*t+2] - reach, 0) / SMOOTH_TILE_COLS ; tj <= min(box[4*t+3] + reach, data->cols-1) / SMOOTH_TILE_COLS ; tj++ )
+                band[ti * tiles_j + tj] = 1;
+    }
+
+    FreeMem(box);
+}
+
+// dist[k] is the distance of row k (if rows) or column k to the nearest one
+// with a hole pixel, more than n if there is none
+static void BandLines(Data *data, int rows, int *dist)
+{
+    int i,j,k;
+    int n = rows ? data->rows : data->cols;
+
+    for( k=0 ; k < n ; k++ )
+        dist[k] = n + 1;
+
+    for( i=0 ; i < data->rows ; i++ )
+        for( j=0 ; j < data->cols ; j++ )
+            if( !InDomain(data,PixelIndex(data,i,j)) )
+                dist[rows ? i : j] = 0;
+
+    for( k=1 ; k < n ; k++ )
+        dist[k] = min(dist[k], dist[k-1] + 1);
+    for( k=n-2 ; k >= 0 ; k-- )
+        dist[k] = min(dist[k], dist[k+1] + 1);
+}
+
+// Gaussian smoothing of plane c of the tile of SMOOTH_TILE_ROWS x
+// SMOOTH_TILE_COLS pixels at (i0,j0), into MImage or, for the domain plane,
+// MDomain. The tile and a halo of s are copied column by column into S, then
+// the column sums go to T and the row sums of these back to S. Both passes
+// run along the columns of S and T, so they vectorize, and the sums are
+// taken in the order of the kernel as before. S is read and written along
+// the contiguous direction of the layout.
+static void SmoothTile(Data *data, int c, int i0, int j0, Real *S, Real *T)
+{
+    int s = (data->lenSK1 - 1)/2;
+    int ni = min(SMOOTH_TILE_ROWS, data->rows - i0);
+    int nj = min(SMOOTH_TILE_COLS, data->cols - j0);
+    int hi = ni + 2*s; // rows of S
+    int hj = nj + 2*s; // columns of S and T
+    int ii,jj,h;
+    Real k;
+    Real *col;
+    const Real *src;
+
+    // S column jj, row ii: pixel (i0-s+ii, j0-s+jj)
+    if( data->layout == LAYOUT_INTERLEAVED )
+    {
+        for( ii=0 ; ii < hi ; ii++ )
+            for( jj=0 ; jj < hj ; jj++ )
+                S[jj*hi + ii] = PlaneSample(data, c, i0 - s + ii, j0 - s + jj);
+    }
+    else
+    {
+        for( jj=0 ; jj < hj ; jj++ )
+            for( ii=0 ; ii < hi ; ii++ )
+                S[jj*hi + ii] = PlaneSample(data, c, i0 - s + ii, j0 - s + jj);
+    }
+
+    // column sums, T column jj, row ii: pixel (i0+ii, j0-s+jj)
+    for( jj=0 ; jj < hj ; jj++ )
+    {
+        col = T + jj*ni;
+        for( ii=0 ; ii < ni ; ii++ )
+            col[ii] = 0;
+        for( h=0 ; h < data->lenSK1 ; h++ )
+        {
+            k = data->SKernel1[h];
+            src = S + jj*hi + h;
+            for( ii=0 ; ii < ni ; ii++ )
+                col[ii] = col[ii] + k * src[ii];
+        }
+    }
+
+    // row sums, S column jj, row ii: pixel (i0+ii, j0+jj)
+    for( jj=0 ; jj < nj ; jj++ )
+    {
+        col = S + jj*ni;
+        for( ii=0 ; ii < ni ; ii++ )
+            col[ii] = 0;
+        for( h=0 ; h < data->lenSK1 ; h++ )
+        {
+            k = data->SKernel1[h];
+            src = T + (jj+h)*ni;
+            for( ii=0 ; ii < ni ; ii++ )
+                col[ii] = col[ii] + k * src[ii];
+        }
+    }
+
+    if( data->layout == LAYOUT_INTERLEAVED )
+    {
+        for( ii=0 ; ii < ni ; ii++ )
+            for( jj=0 ; jj < nj ; jj++ )
+                SetPlaneSample(data, c, i0 + ii, j0 + jj, S[jj*ni + ii]);
+    }
+    else
+    {
+        for( jj=0 ; jj < nj ; jj++ )
+            for( ii=0 ; ii < ni ; ii++ )
+                SetPlaneSample(data, c, i0 + ii, j0 + jj, S[jj*ni + ii]);
+    }
+}
+
+// coefficients of the recursive Gaussian of Young and van Vliet (1995),
+// y[n] = B x[n] + b[0] y[n-1] + b[1] y[n-2] + b[2] y[n-3]; for sigma >= 0.5
+static void RecursiveCoefficients(double sigma, double *B, double *b)
+{
+    double q,b0;
+
+    if( sigma >= 2.5 )
+        q = 0.98711 * sigma - 0.96330;
+    else
+        q = 3.97156 - 4.14554 * sqrt(1 - 0.26891 * sigma);
+
+    b0 = 1.57825 + 2.44413*q + 1.4281*q*q + 0.422205*q*q*q;
+    b[0] = (2.44413*q + 2.85619*q*q + 1.26661*q*q*q) / b0;
+    b[1] = -(1.4281*q*q + 1.26661*q*q*q) / b0;
+    b[2] = 0.422205*q*q*q / b0;
+    *B = 1 - (b[0] + b[1] + b[2]);
+}
+
+// the n values x[0], x[stride], ... filtered in place, forward and backward,
+// and multiplied by gain; zero before the start and over pad values after
+// the end, w holds n + pad values of scratch
+static void RecursiveLine(Real *x, int n, int stride, int pad, double gain, double B, const double *b, Real *w)
+{
+    int k;
+    double y,y1,y2,y3;
+
+    y1 = y2 = y3 = 0;
+    for( k=0 ; k < n + pad ; k++ )
+    {
+        y = B * (k < n ? x[k*stride] : 0) + b[0]*y1 + b[1]*y2 + b[2]*y3;
+        w[k] = y;
+        y3 = y2;
+        y2 = y1;
+        y1 = y;
+    }
+
+    y1 = y2 = y3 = 0;
+    for( k = n + pad - 1 ; k >= 0 ; k-- )
+    {
+        y = B * w[k] + b[0]*y1 + b[1]*y2 + b[2]*y3;
+        if( k < n )
+            x[k*stride] = gain * y;
+        y3 = y2;
+        y2 = y1;
+        y1 = y;
+    }
+}
+
+// SmoothImage with SMOOTHING_RECURSIVE: the planes are copied to MImage and
+// MDomain and filtered there along the columns, then along the rows. The
+// filter has gain 1, the gain of SKernel1 is applied, which is not
+// normalized. Only the rows and the columns within reach of the hole are
+// filtered, in runs that reach pad further and with zeros beyond, as at the
+// border of the image.
+static void SmoothImageRecursive(Data *data)
+{
+    int i,j,c,k;
+    int i0,i1,j0,j1;
+    int line;
+    int ncols = (data->channels + 1) * data->cols;
+    int nrows = (data->channels + 1) * data->rows;
+    int pad;
+    int reach,ext;
     int index;
-    
+    double B,b[3];
+    double gain = 0;
+    int *rdist;
+    int *cdist;
+    Real *w;
+
+    RecursiveCoefficients(data->sigma, &B, b);
+    for( k=0 ; k < data->lenSK1 ; k++ )
+        gain = gain + data->SKernel1[k];
+    pad = (int) (4 * data->sigma) + 4;
+
+    reach = SmoothReach(data);
+    ext = reach + pad;
+    rdist = (int *) AllocMem(sizeof(int) * data->rows);
+    cdist = (int *) AllocMem(sizeof(int) * data->cols);
+    BandLines(data, 1, rdist);
+    BandLines(data, 0, cdist);
+
+    for( j=0 ; j < data->cols ; j++ )
+        for( i=0 ; (cdist[j] <= ext) && (i < data->rows) ; i++ )
+            if( rdist[i] <= ext )
+            {
+                index = PixelIndex(data,i,j);
+                data->MDomain[index] = InDomain(data,index);
+                for( c=0 ; c < data->channels ; c++ )
+                    data->MImage[SampleIndex(data,index,c)] = data->Image[SampleIndex(data,index,c)];
+            }
+
+    // the columns, then the rows of the planes; plane data->channels is
+    // the domain
+    #pragma omp parallel private(w,i,j,c,i0,i1,j0,j1,line) num_threads(NumThreads(data))
+    {
+        w = (Real *) AllocMem(sizeof(Real) * (max(data->rows,data->cols) + pad));
+
+        #pragma omp for schedule(dynamic,16)
+        for( line=0 ; line < ncols ; line++ )
+        {
+            c = line / data->cols;
+            j = line % data->cols;
+            if( cdist[j] > ext )
+                continue;
+
+            for( i0=0 ; i0 < data->rows ; i0 = i1+1 )
+            {
+                for( ; (i0 < data->rows) && (rdist[i0] > ext) ; i0++ );
+                for( i1=i0 ; (i1+1 < data->rows) && (rdist[i1+1] <= ext) ; i1++ );
+                if( i0 == data->rows )
+                    break;
+
+                if( c == data->channels )
+                    RecursiveLine(data->MDomain + PixelIndex(data,i0,j), i1-i0+1, data->istride, pad, gain, B, b, w);
+                else
+                    RecursiveLine(data->MImage + SampleIndex(data,PixelIndex(data,i0,j),c), i1-i0+1, data->istride * data->pstride, pad, gain, B, b, w);
+            }
+        }
+
+        #pragma omp for schedule(dynamic,16)
+        for( line=0 ; line < nrows ; line++ )
+        {
+            c = line / data->rows;
+            i = line % data->rows;
+            if( rdist[i] > reach )
+                continue;
+
+            for( j0=0 ; j0 < data->cols ; j0 = j1+1 )
+            {
+                for( ; (j0 < data->cols) && (cdist[j0] > ext) ; j0++ );
+                for( j1=j0 ; (j1+1 < data->cols) && (cdist[j1+1] <= ext) ; j1++ );
+                if( j0 == data->cols )
+                    break;
+
+                if( c == data->channels )
+                    RecursiveLine(data->MDomain + PixelIndex(data,i,j0), j1-j0+1, data->jstride, pad, gain, B, b, w);
+                else
+                    RecursiveLine(data->MImage + SampleIndex(data,PixelIndex(data,i,j0),c), j1-j0+1, data->jstride * data->pstride, pad, gain, B, b, w);
+            }
+        }
+
+        FreeMem(w);
+    }
+
+    FreeMem(rdist);
+    FreeMem(cdist);
+}
+
+// smooths the image and the domain with SKernel1 into MImage and MDomain,
+// in the tiles within SmoothReach of the hole; these are spread over the
+// threads, with all planes
+void SmoothImage(Data *data)
+{
+    int s;
+    int tiles_i,tiles_j,tiles;
+    int t,c;
+    unsigned char *band;
+    Real *S;
+    Real *T;
+
     if(data->SKernel1 == NULL) // i.e. sigma == 0
         return;
-    
+
+    if( (data->smoothing == SMOOTHING_RECURSIVE) && (data->sigma >= 0.5) )
+    {
+        SmoothImageRecursive(data);
+        return;
+    }
+
 	s = (data->lenSK1 - 1)/2;
-	
-	for( c=0 ; c <= data->channels ; c++)
-	{
-		for( i=0 ; i < data->rows ; i++)
-		{
-			for( j= -s ; j < data->cols + s ; j++)
-			{
-				p = (j+s) % data->lenSK1;
-				data->Shelp[p] = 0;
-				
-				// colum sums
-				if( (0 <= j) && ( j < data->cols) )
-				{
-					// colum sums
-					for( h = 0 ; h < data->lenSK1 ; h++)
-					{
-						ri = i-s+h;
-						if( (ri < 0) || (ri >= data->rows) )
-							continue;
-						
-                        index = j * data->rows + ri;
-                        
-						if( c == data->channels )
-                            data->Shelp[p] = data->Shelp[p] + data->SKernel1[h] * data->Domain[index];
-						else
-							data->Shelp[p] = data->Shelp[p] + data->SKernel1[h] * data->Image[index + c * data->size];
-					}
-				}
-				
-				if( j >= s )
-				{
-                    index = (j-s) * data->rows + i;
-                    
-					if( c == data->channels )
-						data->MDomain[index]  = 0;
-					else
-						data->MImage[index + c * data->size] = 0;
-					
-					
-					for( h = 0 ; h < data->lenSK1 ; h++)
-					{
-						ph = (p+1+h) % data->lenSK1;
-						
-						if( c == data->channels )
-							data->MDomain[index] = data->MDomain[index] + data->SKernel1[h] * data->Shelp[ph];
-						else
-							data->MImage[index + c * data->size] = data->MImage[index + c * data->size] + data->SKernel1[h] * data->Shelp[ph];
-					}
-				}
-			}
-		}
-	}
+    tiles_i = (data->rows + SMOOTH_TILE_ROWS - 1) / SMOOTH_TILE_ROWS;
+    tiles_j = (data->cols + SMOOTH_TILE_COLS - 1) / SMOOTH_TILE_COLS;
+    tiles = tiles_i * tiles_j;
+
+    band = (unsigned char *) AllocMem(tiles);
+    BandTiles(data, SmoothReach(data), tiles_i, tiles_j, band);
+
+    #pragma omp parallel private(S,T,t,c) num_threads(NumThreads(data))
+    {
+        S = (Real *) AllocMem(sizeof(Real) * (SMOOTH_TILE_ROWS + 2*s) * (SMOOTH_TILE_COLS + 2*s));
+        T = (Real *) AllocMem(sizeof(Real) * SMOOTH_TILE_ROWS * (SMOOTH_TILE_COLS + 2*s));
+
+        #pragma omp for schedule(dynamic)
+        for( t=0 ; t < (data->channels + 1) * tiles ; t++ )
+        {
+            if( !band[t % tiles] )
+                continue;
+            c = t / tiles;
+            SmoothTile(data, c, ((t % tiles) / tiles_j) * SMOOTH_TILE_ROWS, ((t % tiles) % tiles_j) * SMOOTH_TILE_COLS, S, T);
+        }
+
+        FreeMem(S);
+        FreeMem(T);
+    }
+
+    FreeMem(band);
 }
 // end smoothing
 
 // procs for inpainting
+
+// sets up data->Known, and the pyramid of the far field, from data->Flag
+void InitKnown(Data *data)
+{
+    int i,j;
+
+    if( data->Known == NULL )
+        data->Known = (unsigned int *) AllocMem(sizeof(unsigned int) * DOMAIN_WORDS(data->size));
+
+    memset(data->Known, 0, sizeof(unsigned int) * DOMAIN_WORDS(data->size));
+    InitPyramid(data);
+    for( i=0 ; i < data->rows ; i++ )
+        for( j=0 ; j < data->cols ; j++ )
+            if( data->Flag[PixelIndex(data,i,j)] == KNOWN )
+                MarkKnown(data,i,j);
+}
+
+// Flag KNOWN for the pixel (i,j), atomically for the waves of InpaintByWaves
+void MarkKnown(Data *data, int i, int j)
+{
+    int b = KnownBit(data,i,j);
+
+    data->Flag[PixelIndex(data,i,j)] = KNOWN;
+#ifdef _OPENMP
+    #pragma omp atomic
+#endif
+    data->Known[b >> 5] |= 1u << (b & 31);
+
+    if( data->Pyramid != NULL )
+        AddToPyramid(data,i,j);
+    if( data->RowT != NULL )
+        AddKnownToRows(data,i,j);
+}
+
+// sets up data->ImageQ from data->Image for PRECISION_FIXED: the values of
+// 8 bit images, rounded to FIXED_SHIFT fractional bits
+void InitFixed(Data *data)
+{
+    int k;
+
+    if( data->precision != PRECISION_FIXED )
+        return;
+
+    if( data->ImageQ == NULL )
+        data->ImageQ = (short *) AllocMem(sizeof(short) * data->size * data->channels);
+
+    for( k=0 ; k < data->size * data->channels ; k++ )
+        data->ImageQ[k] = FixedValue(data->Image[k]);
+}
+
+// Points with equal T are one level: they do not read each other since
+// their flags are not KNOWN yet and inpaintPoint skips neighbours with the
+// same T. So the points of a level are inpainted in parallel, and the result
+// does not depend on the number of threads. With data->tband > 0 the T values
+// are first rounded down to multiples of tband, which merges the levels into
+// bands of width tband and relaxes the order inside a band. The scheduler
+// SCHEDULE_WAVES runs points of different levels in parallel as well, see
+// inpainting_sched.cpp; not with the far field.
+
 void InpaintByOrder(Data *data)
 {
-	int k,kk,kold;
+	int k,kk,kold,knext;
     int i;
     int j;
     int stop;
-    int index;
-    double Told,Tact;
+    int nthreads;
+    int kreport;
+    Real Tact;
+    Real *Ihelp;
+    unsigned int *mark;
     
     stop = 3 * data->nof_points2inpaint;
+
+    SetStencil(data); // if SetKernels was not called
+    InitKnown(data);
+    InitFixed(data);
+    InitGradients(data);
+
+    if( data->tband > 0 )
+        QuantizeOrder(data, data->tband);
+
+    // the waves would read cells of the pyramid while they change
+    if( data->scheduler == SCHEDULE_WAVES )
+    {
+        if( data->Pyramid == NULL )
+        {
+            InpaintByWaves(data);
+            return;
+        }
+        ReportMessage(data, "The far field does not combine with the waves scheduler. Inpainting level by level. \n");
+    }
+
+    nthreads = NumThreads(data);
+    Ihelp = (Real *) AllocMem(sizeof(Real) * data->channels * nthreads);
+    mark = (unsigned int *) AllocMem(sizeof(unsigned int) * DOMAIN_WORDS(data->size));
+    memset(mark, 0, sizeof(unsigned int) * DOMAIN_WORDS(data->size));
     
     kold = 0;
-    Told = data->ordered_points[2];
+    kreport = -1;
+    ReportStage(data, STAGE_INIT, 0);
     
-	for( k=0 ; k < stop ; k=k+3 )
+	for( k=0 ; k < stop ; k=knext )
 	{
-		if (k%500==0) gimp_progress_update(0.3 + 0.6*(gdouble)k/(gdouble)(stop));
+		if( k/1500 != kreport )
+		{
+			kreport = k/1500;
+			ReportProgress(data, 0.3 + 0.6*(double)k/(double)(stop));
+		}
         Tact = data->ordered_points[k+2];
+
+        // level [k,knext) ends at the first point with a larger T
+        for( knext=k+3 ; (knext < stop) && (data->ordered_points[knext+2] <= Tact) ; knext=knext+3 );
         
-        if( Tact > Told ) // update
+        // update, the previous level becomes known
+        SmoothUpdateLevel(data, kold, k, mark);
+        ReportStage(data, STAGE_UPDATE, (k - kold)/3);
+        kold = k;
+
+        #pragma omp parallel for private(i,j) schedule(dynamic,8) num_threads(nthreads) if( knext-k >= 3*PARALLEL_MIN_POINTS )
+		for( kk=k ; kk < knext ; kk=kk+3 )
+		{
+			i = (int) (data->ordered_points[kk]);
+			j = (int) (data->ordered_points[kk+1]);
+
+			inpaintPoint(data,i,j,Ihelp + ThreadNum() * data->channels);
+		}
+        ReportStage(data, STAGE_LEVEL, (knext - k)/3);
+	}
+
+    FreeMem(Ihelp);
+    FreeMem(mark);
+}
+
+// rounds the T values of the points to inpaint down to multiples of tband
+void QuantizeOrder(Data *data, double tband)
+{
+    int k;
+    int index;
+    double T;
+
+    for( k=0 ; k < 3 * data->nof_points2inpaint ; k=k+3 )
+    {
+        index = PixelIndex(data, (int) (data->ordered_points[k]), (int) (data->ordered_points[k+1]));
+        T = floor(data->ordered_points[k+2] / tband) * tband;
+
+        data->ordered_points[k+2] = T;
+        data->Tfield[index] = T;
+    }
+}
+
+void inpaintPoint(Data *data,int xi,int xj)
+{
+    inpaintPoint(data,xi,xj,data->Ihelp);
+}
+
+// In PRECISION_FIXED the weights of a point are scaled by a power of two
+// so that the largest one so far is in [1/2,1), scale 0 before the first
+// one. FixedRescale lowers the scale and the sums so far for a weight w above
+// 1/scale; the integer weights 1 + FIXED_WSCALE * scale * w then resolve w
+// down to a fraction 1/FIXED_WSCALE of the largest one, not down to 2^-64 of
+// 1 as the insurance of the other modes.
+void FixedRescale(Data *data, Real w, Real *scale, Real *Ihelp, Real *W)
+{
+    int c;
+    Real f;
+
+    // also for w NaN or Inf, which ilogb does not take
+    if( !(w > 0) || !isfinite(w) || ((*scale != 0) && (w * *scale < 1)) )
+        return;
+
+    f = ldexp(1.0, -ilogb(w) - 1);
+    if( *scale != 0 )
+    {
+        for( c=0 ; c < data->channels ; c++ )
+            Ihelp[c] = Ihelp[c] * (f / *scale);
+        *W = *W * (f / *scale);
+    }
+    *scale = f;
+}
+
+// weights and sums of a block of nb neighbours; k holds their stencil
+// entries, s their position in Image. The weights of the block are computed
+// in one loop, the sums are taken in stencil order.
+// z and the weights are computed from vi, vj and r in the order of the
+// upstream loop over the square, so that they round the same.
+static inline void AccumulateBlock(Data *data, const double *G, Real zfac, const int *k, const int *s, int nb, Real *Ihelp, Real *W, Real *Wk, Real *scale)
+{
+    int b,c;
+    Real z;
+    double vi,vj;
+    Real w;
+    Real wb[STENCIL_BLOCK];
+    int wq[STENCIL_BLOCK];
+    int Wq;
+    long long sum;
+
+    if( (data->guidance != 0) && (data->precision != PRECISION_EXACT) )
+    {
+        #pragma omp simd private(z,vi,vj)
+        for( b=0 ; b < nb ; b++ )
+        {
+            vi = data->StencilI[k[b]];
+            vj = data->StencilJ[k[b]];
+            z = zfac * (G[0]*vi*vi + 2*G[1]*vi*vj + G[2]*vj*vj);
+            wb[b] = FastExp(-z * 0.5 ) / data->StencilR[k[b]];
+        }
+    }
+    else if(data->guidance != 0)
+    {
+        #pragma omp simd private(z,vi,vj)
+        for( b=0 ; b < nb ; b++ )
+        {
+            vi = data->StencilI[k[b]];
+            vj = data->StencilJ[k[b]];
+            z = zfac * (G[0]*vi*vi + 2*G[1]*vi*vj + G[2]*vj*vj);
+            wb[b] = exp(-z * 0.5 ) / data->StencilR[k[b]];
+        }
+    }
+    else
+    {
+        for( b=0 ; b < nb ; b++ )
+            wb[b] = 1 / data->StencilR[k[b]];
+    }
+
+    // the insurance in integers: 1 + FIXED_WSCALE * scale * w, and sums of
+    // 32 bit products of 16 bit values
+    if( data->precision == PRECISION_FIXED )
+    {
+        w = 0;
+        for( b=0 ; b < nb ; b++ )
+            w = max(w, wb[b]);
+        FixedRescale(data, w, scale, Ihelp, W);
+
+        Wq = 0;
+        for( b=0 ; b < nb ; b++ )
+        {
+            *Wk = *Wk + wb[b];
+            wq[b] = 1 + (int) (FIXED_WSCALE * FixedFraction(*scale, wb[b]));
+            Wq += wq[b];
+        }
+        *W = *W + Wq;
+
+        for( c=0 ; c < data->channels ; c++ )
+        {
+            sum = 0;
+            for( b=0 ; b < nb ; b++ )
+                sum += wq[b] * data->ImageQ[s[b] + c * data->cstride];
+            Ihelp[c] = Ihelp[c] + sum;
+        }
+        return;
+    }
+
+    for( b=0 ; b < nb ; b++ )
+    {
+        w = wb[b];
+        *Wk = *Wk + w;
+        w = 1 + (1.844674407370955e+19 * w); // insurance
+        *W = *W + w;
+
+        // average image values
+        for( c=0 ; c < data->channels ; c++ )
+            Ihelp[c] = Ihelp[c] + w * data->Image[s[b] + c * data->cstride];
+    }
+}
+
+// weighted sums over the known neighbours of an earlier level; the disc is
+// scanned row by row in stencil order, visiting the known pixels only. With
+// zcut > 0 only the offsets v with zfac * v'Gv <= zcut are visited, the
+// rows of the disc are cut down to this ellipse. With the far field only the
+// disc of radius nearfield is visited.
+static void ScanDisc(Data *data, int xi, int xj, const double *G, Real zfac, double zcut, Real *Ihelp, Real *W, Real *Wk, Real *scale)
+{
+    int indexy;
+    int yi,yj;
+    int c;
+    int k;
+    int r,vi,w;
+    int lo,hi;
+    int nf,wn;
+    int b0,b1,b,e;
+    int nb;
+    int kb[STENCIL_BLOCK];
+    int sb[STENCIL_BLOCK];
+    double q,d;
+    double dlo,dhi;
+    Real Tx = data->Tfield[PixelIndex(data,xi,xj)];
+
+    for( c=0 ; c < data->channels ; c++ )
+        Ihelp[c] = 0;
+    *W = 0;
+    *Wk = 0;
+    *scale = 0;
+
+    nf = (data->Pyramid != NULL) ? data->nearfield : data->radius;
+
+    nb = 0;
+    for( r=0 ; r < 2*data->radius+1 ; r++ )
+    {
+        vi = r - data->radius;
+        yi = xi + vi;
+        if( (yi < 0) || (yi >= data->rows) || (vi*vi > nf*nf) )
+            continue;
+
+        // the row covers vj = -w..w, without the centre if vi == 0, and
+        // vj = -wn..wn of it are within nf
+        k = data->StencilRow[r];
+        w = -data->StencilJ[k];
+        for( wn = min(w, (int) sqrt((double) (nf*nf - vi*vi))) ; vi*vi + wn*wn > nf*nf ; wn-- );
+        for( ; (wn < w) && (vi*vi + (wn+1)*(wn+1) <= nf*nf) ; wn++ );
+        lo = -wn;
+        hi = wn;
+
+        // G2 vj^2 + 2 G1 vi vj <= q, an interval of vj if G2 > 0
+        if( (zcut > 0) && (G[2] > 0) )
+        {
+            q = zcut / zfac - G[0]*vi*vi;
+            d = G[1]*G[1]*vi*vi + G[2]*q;
+            if( d < 0 )
+                continue;
+            d = sqrt(d);
+            dlo = (-G[1]*vi - d) / G[2];
+            dhi = (-G[1]*vi + d) / G[2];
+            if( (dlo > hi) || (dhi < lo) )
+                continue;
+            if( dlo > lo )
+                lo = (int) ceil( dlo - 1e-9 );
+            if( dhi < hi )
+                hi = (int) floor( dhi + 1e-9 );
+        }
+
+        b0 = KnownBit(data,yi,max(xj + lo, 0));
+        b1 = KnownBit(data,yi,min(xj + hi, data->cols-1));
+
+        // runs b..e-1 of known pixels
+        for( b = ScanKnownUp(data,b0,b1,1) ; b <= b1 ; b = ScanKnownUp(data,e,b1,1) )
         {
-            for( kk=kold; kk < k ; kk=kk+3)
+            e = ScanKnownUp(data,b,b1,0);
+            for( yj = b - KnownBit(data,yi,0) ; yj < e - KnownBit(data,yi,0) ; yj++ )
             {
-                i = (int) (data->ordered_points[kk]);
-                j = (int) (data->ordered_points[kk+1]);
-                index = j * data->rows + i;
-                
-                data->Tfield[index].flag = KNOWN;
-                data->Domain[index] = 1;
-                SmoothUpdate(data,i,j);
+                indexy = PixelIndex(data,yi,yj);
+
+                // the entry is always written and kept by advancing nb,
+                // without a branch; the centre is not known
+                kb[nb] = k + (yj - xj + w) - ((vi == 0) && (yj > xj));
+                sb[nb] = SampleIndex(data,indexy,0);
+                nb += (data->Tfield[indexy] != Tx);
+
+                if( nb == STENCIL_BLOCK )
+                {
+                    AccumulateBlock(data, G, zfac, kb, sb, nb, Ihelp, W, Wk, scale);
+                    nb = 0;
+                }
             }
-            kold = k;
-            Told = Tact;
         }
-		i = (int) (data->ordered_points[k]);
-        j = (int) (data->ordered_points[k+1]);
-
-		inpaintPoint(data,i,j);
-	}
+    }
+    AccumulateBlock(data, G, zfac, kb, sb, nb, Ihelp, W, Wk, scale);
 }
 
-void inpaintPoint(Data *data,int xi,int xj)
+// Ihelp holds data->channels values of scratch space
+void inpaintPoint(Data *data,int xi,int xj,Real *Ihelp)
 {
     int indexx;
-    int indexy;
-	int yi,yj;
     int c;
 	
     double G[3];
-	double z;
-	double vi,vj;
-	double r;
-    double w;
-    double W = 0;
-    double Wk = 0;
+	Real zfac;
+    Real W;
+    Real Wk;
+    Real scale;
     
-    indexx = xj * data->rows + xi;
-	
-	//init Ihelp
-	for( c=0 ; c < data->channels ; c++ )
-		data->Ihelp[c] = 0;
+    indexx = PixelIndex(data,xi,xj);
 
     if( data->guidance == 1 )
         Guidance(data,xi,xj,G);
@@ -188,72 +915,52 @@ void inpaintPoint(Data *data,int xi,int xj)
         G[1] = data->GivenGuidanceT[indexx + data->size];
         G[2] = data->GivenGuidanceT[indexx + 2*data->size];
     }
-    
-	for( yi = max(xi - data->radius,0); (yi <= xi + data->radius) && ( yi < data->rows); yi++)
-	{
-		for(yj = max(xj - data->radius,0); (yj <= xj + data->radius) && (yj < data->cols); yj++)
-		{
 
-            indexy = yj * data->rows + yi;
-            
-			if( data->Tfield[indexy].flag != KNOWN)
-				continue;
+    zfac = (data->kappa)/(data->epsilon);
+    zfac = zfac * zfac;
 
-			if( data->Tfield[indexy].T == data->Tfield[indexx].T )
-				continue;
-							
-			vi = yi-xi;
-			vj = yj-xj;
-			r = sqrt( vi*vi + vj*vj );
-			
-			if(r > data->radius)
-				continue;
+    // exp(-z/2) < cutoff beyond z = -2 log(cutoff); if the ellipse holds
+    // no neighbour, the whole disc is taken as without the cutoff
+    if( (data->guidance != 0) && (data->cutoff > 0) && (zfac > 0) )
+    {
+        ScanDisc(data, xi, xj, G, zfac, -2 * log(data->cutoff), Ihelp, &W, &Wk, &scale);
+        if( W == 0 )
+            ScanDisc(data, xi, xj, G, zfac, 0, Ihelp, &W, &Wk, &scale);
+    }
+    else
+        ScanDisc(data, xi, xj, G, zfac, 0, Ihelp, &W, &Wk, &scale);
 
-			// compute weight
-            if(data->guidance != 0)
-            {
-                z = (data->kappa)/(data->epsilon);
-                z = z * z;
-                z = z * (G[0]*vi*vi + 2*G[1]*vi*vj + G[2]*vj*vj);
-                w  = exp(-z * 0.5 )/r;
-                
-            }
-            else
-            {
-                w = 1/r;
-            }
-            
-            Wk = Wk + w;
-            w = 1 + (1.844674407370955e+19 * w); // insurance
-			W = W + w;
-            
-			// average image values
-			for( c=0 ; c < data->channels ; c++ )
-				data->Ihelp[c] = data->Ihelp[c] + w * data->Image[indexy + c * data->size];
-		}
-	}
-	
-    
-	if( W == 0 ) 
-	{
-		// Wk == 0 :may happen if kappa is too large
+    if( data->Pyramid != NULL )
+        FarField(data, xi, xj, G, zfac, Ihelp, &W, &Wk, &scale);
+
+
+    if( W == 0 ) 
+    {
+        // Wk == 0 :may happen if kappa is too large
         // W == 0 : happens if order not well defined or epsilon is too small
         data->inpaint_undefined = 1;
-        
+
         // debug
-		// mexPrintf(" Wk is %lf , W is %lf , at %d %d \n",Wk,W,xi,xj );
-	}
-    
-	for( c=0 ; c < data->channels ; c++ )
+        // mexPrintf(" Wk is %lf , W is %lf , at %d %d \n",Wk,W,xi,xj );
+    }
+
+    for( c=0 ; c < data->channels ; c++ )
     {
-		data->Image[indexx + c * data->size ] = data->Ihelp[c]/W;
+        if( data->precision == PRECISION_FIXED )
+        {
+            // the sums are over ImageQ
+            data->Image[SampleIndex(data,indexx,c)] = Ihelp[c]/W * (1.0 / (1 << FIXED_SHIFT));
+            data->ImageQ[SampleIndex(data,indexx,c)] = FixedValue(data->Image[SampleIndex(data,indexx,c)]);
+        }
+        else
+            data->Image[SampleIndex(data,indexx,c)] = Ihelp[c]/W;
         
         // debug
-        // if( isnan( data->Image[indexx + c * data->size] ) )
-        //    mexPrintf(" pixel value is %lf at %d %d \n",data->Image[indexx + c * data->size],xi,xj );
+        // if( isnan( data->Image[SampleIndex(data,indexx,c)] ) )
+        //    mexPrintf(" pixel value is %lf at %d %d \n",data->Image[SampleIndex(data,indexx,c)],xi,xj );
     }
     
-    data->Domain[indexx] = 1; // inpainting domain shrinks by one pixel
+    SetDomain(data,indexx,1); // inpainting domain shrinks by one pixel
 }
 
 void Guidance(Data *data, int xi, int xj, double *G)
@@ -274,6 +981,8 @@ void Guidance(Data *data, int xi, int xj, double *G)
 
     if( coh_meas == 0)
         confidence = 0;
+    else if( data->precision != PRECISION_EXACT )
+        confidence = FastExp( -(data->delta_quant4) / coh_meas ) / coh_meas_sqrt;
     else
         confidence = exp( -(data->delta_quant4) / coh_meas ) / coh_meas_sqrt;
         
@@ -284,228 +993,566 @@ void Guidance(Data *data, int xi, int xj, double *G)
 	
 }
 
+// convex weighted sum over the channels of grad u grad u^T at pixel (i,j),
+// u = MImage/MDomain by central differences, one-sided next to the border
+// and to pixels without MDomain; zero where MDomain is zero
+static void GradientTensor(Data *data, int i, int j, Real *J)
+{
+    int index;
+    int indexc;
+    int c;
+    Real a;
+    Real u0,u1;
+    Real dx,dy;
+    int di,dj;   // neighbours in i and j, per pixel
+    int dis,djs; // and in the image
+
+    J[0] = 0;
+    J[1] = 0;
+    J[2] = 0;
+
+    index = PixelIndex(data,i,j);
+    if( data->MDomain[index] == 0 )
+        return;
+
+    di = data->istride;
+    dj = data->jstride;
+    dis = di * data->pstride;
+    djs = dj * data->pstride;
+
+    for( c=0 ; c < data->channels ; c++) // for each color channel
+    {
+        indexc = SampleIndex(data,index,c);
+
+        // values
+        if( (i==0) || (data->MDomain[index - di] == 0) )
+            u0 = data->MImage[indexc]/data->MDomain[index];
+        else
+            u0 = data->MImage[indexc - dis]/data->MDomain[index - di];
+
+        if( (i== data->rows-1) || (data->MDomain[index + di] == 0) )
+            u1 = data->MImage[indexc]/data->MDomain[index];
+        else
+            u1 = data->MImage[indexc + dis]/data->MDomain[index + di];
+
+        dx = (u1 - u0)/2;
+
+        if( (j==0) || (data->MDomain[index - dj] == 0) )
+            u0 = data->MImage[indexc]/data->MDomain[index];
+        else
+            u0 = data->MImage[indexc - djs]/data->MDomain[index - dj];
+
+        if( (j== data->cols-1) || (data->MDomain[index + dj] == 0) )
+            u1 = data->MImage[indexc]/data->MDomain[index];
+        else
+            u1 = data->MImage[indexc + djs]/data->MDomain[index + dj];
+
+        dy = (u1 - u0)/2;
+
+        a = (data->convex == NULL) ? 1.0 / data->channels : data->convex[c];
+        J[0] = J[0] + a * dx * dx;
+        J[1] = J[1] + a * dx * dy;
+        J[2] = J[2] + a * dy * dy;
+    }
+}
+
+// adds m times the tensor J of pixel (i,j) to the row sums RowT of the
+// pixels (i,xj) whose window row reaches it
+static void AddToRows(Data *data, int i, int j, const Real *J, Real m)
+{
+    int xj;
+    int r = (data->lenSK2-1)/2;
+    Real k;
+    Real *R;
+
+    for( xj = max(j-r,0) ; xj <= min(j+r,data->cols-1) ; xj++ )
+    {
+        k = m * data->SKernel2[xj + r - j];
+        R = data->RowT + 4 * PixelIndex(data,i,xj);
+        R[0] = R[0] + k * J[0];
+        R[1] = R[1] + k * J[1];
+        R[2] = R[2] + k * J[2];
+        R[3] = R[3] + k;
+    }
+}
+
+// sets up data->GradT, the GradientTensor of every pixel, from MImage and
+// MDomain; SmoothUpdate keeps it up to date. For large windows also the row
+// sums RowT of ModStructureTensor over the known pixels, kept up to date by
+// MarkKnown and SmoothUpdate. A point then reads lenSK2 row sums instead of
+// lenSK2^2 pixels, but an update changes GradT in a square of lenSK1 + 2 and
+// every change costs lenSK2; on the examples they break even where lenSK2
+// is the size of that square. They need the order of T, not a given one.
+// Both are only read within lenSK2/2 of the hole, so only the tiles of
+// SmoothImage within that reach are set up; GradT is zero elsewhere.
+void InitGradients(Data *data)
+{
+    int i,j;
+    int s;
+    int tiles_i,tiles_j,tiles;
+    int t,i0,j0;
+    unsigned char *band;
+
+    if( data->guidance != 1 )
+        return;
+
+    if( data->GradT == NULL )
+        data->GradT = (Real *) AllocMem(sizeof(Real) * 3 * data->size);
+
+    tiles_i = (data->rows + SMOOTH_TILE_ROWS - 1) / SMOOTH_TILE_ROWS;
+    tiles_j = (data->cols + SMOOTH_TILE_COLS - 1) / SMOOTH_TILE_COLS;
+    tiles = tiles_i * tiles_j;
+    band = (unsigned char *) AllocMem(tiles);
+    BandTiles(data, SmoothReach(data) - 1, tiles_i, tiles_j, band);
+
+    memset(data->GradT, 0, sizeof(Real) * 3 * data->size);
+
+    #pragma omp parallel for private(i,j,i0,j0) schedule(dynamic) num_threads(NumThreads(data))
+    for( t=0 ; t < tiles ; t++ )
+    {
+        if( !band[t] )
+            continue;
+        i0 = (t / tiles_j) * SMOOTH_TILE_ROWS;
+        j0 = (t % tiles_j) * SMOOTH_TILE_COLS;
+        for( j = j0 ; j < min(j0 + SMOOTH_TILE_COLS, data->cols) ; j++ )
+            for( i = i0 ; i < min(i0 + SMOOTH_TILE_ROWS, data->rows) ; i++ )
+                GradientTensor(data, i, j, data->GradT + 3 * PixelIndex(data,i,j));
+    }
+
+    s = (data->SKernel1 != NULL) ? (data->lenSK1-1)/2 : 0;
+    if( (data->ordergiven != 0) || (data->lenSK2 <= (2*s+3)*(2*s+3)) )
+    {
+        FreeMem(band);
+        return;
+    }
+
+    if( data->RowT == NULL )
+        data->RowT = (Real *) AllocMem(sizeof(Real) * 4 * data->size);
+
+    // a row sum that is read only holds pixels of the band
+    memset(data->RowT, 0, sizeof(Real) * 4 * data->size);
+    for( i=0 ; i < data->rows ; i++ )
+        for( j=0 ; j < data->cols ; j++ )
+            if( band[(i / SMOOTH_TILE_ROWS) * tiles_j + j / SMOOTH_TILE_COLS]
+                && (KnownWord(data, KnownBit(data,i,j) >> 5) & (1u << (KnownBit(data,i,j) & 31))) )
+                AddToRows(data, i, j, data->GradT + 3 * PixelIndex(data,i,j), 1);
+
+    FreeMem(band);
+}
+
+// recomputes GradT at (yi,yj), and the row sums if it is known
+static void RefreshGradient(Data *data, int yi, int yj)
+{
+    int b;
+    Real J[3];
+    Real *G;
+
+    G = data->GradT + 3 * PixelIndex(data,yi,yj);
+    GradientTensor(data, yi, yj, J);
+
+    // the row sums hold the known pixels only
+    b = KnownBit(data,yi,yj);
+    if( (data->RowT != NULL) && ((KnownWord(data, b >> 5) >> (b & 31)) & 1) )
+    {
+        AddToRows(data, yi, yj, G, -1);
+        AddToRows(data, yi, yj, J, 1);
+    }
+
+    G[0] = J[0];
+    G[1] = J[1];
+    G[2] = J[2];
+}
+
+// GradientTensor depends on MImage and MDomain within 1, so a change of
+// these within d of (xi,xj) changes it within d+1
+static void RefreshGradients(Data *data, int xi, int xj, int d)
+{
+    int yi,yj;
+
+    if( data->GradT == NULL )
+        return;
+
+    for( yj = max(xj-d-1,0) ; yj <= min(xj+d+1,data->cols-1) ; yj++ )
+        for( yi = max(xi-d-1,0) ; yi <= min(xi+d+1,data->rows-1) ; yi++ )
+            RefreshGradient(data, yi, yj);
+}
+
+// the row sums for a pixel that becomes known
+void AddKnownToRows(Data *data, int i, int j)
+{
+    AddToRows(data, i, j, data->GradT + 3 * PixelIndex(data,i,j), 1);
+}
+
+// the tensors of the channels share the window weights, so their convex
+// combination is the window sum of the per pixel GradientTensor
 void ModStructureTensor(Data *data, int xi,int xj, double *ST)
 {
     int indexx;
     int indexr;
-    int indexrc;
 	int ri,rj;
-	int i,j,c;
+	int i,j;
 	int r;
-	double w,wh;
-	double vs[3];
-	double vsh[3];
-	double u0,u1;
-	double dx,dy;
+	Real w,wh;
+	Real vsh[3];
+	Real Jh[3];
+	const Real *J;
+	int b0,b1,b,e;
 
 	ST[0] = 0;
 	ST[1] = 0;
 	ST[2] = 0;
 	
-    indexx = xj * data->rows + xi;
+    indexx = PixelIndex(data,xi,xj);
 	r = (data->lenSK2-1)/2;
 
-    
-	for( c=0 ; c < data->channels ; c++) // for each color channel
+	w = 0;
+
+	// the known pixels are the ones with a smaller T, so the window rows
+	// are the row sums
+	if( data->RowT != NULL )
 	{
-		// structure tensor
-		vs[0] = 0;
-		vs[1] = 0;
-		vs[2] = 0;
-		w = 0;
 		for(i = 0; i < data->lenSK2 ; i++)
 		{
 			ri = xi+r-i;
 			if( (ri < 0) || (ri >= data->rows) )
 				continue;
 
-			vsh[0] = 0;
-			vsh[1] = 0;
-			vsh[2] = 0;
-			wh = 0;
-			for(j = 0; j < data->lenSK2 ; j++)
-			{
-				rj = xj+r-j;
-				if( (rj < 0) || (rj >= data->cols) )
-					continue;
-				
-                indexr = rj * data->rows + ri;
-                
-				if(data->Tfield[indexr].T >= data->Tfield[indexx].T)
-					continue;
-
-                indexrc = indexr + c * data->size;
-                
-				// values
-				if( (ri==0) || (data->MDomain[indexr - 1] == 0) )
-					u0 = data->MImage[indexrc]/data->MDomain[indexr];
-				else
-					u0 = data->MImage[indexrc - 1]/data->MDomain[indexr - 1];
-
-				if( (ri== data->rows-1) || (data->MDomain[indexr + 1] == 0) )
-					u1 = data->MImage[indexrc]/data->MDomain[indexr];
-				else
-					u1 = data->MImage[indexrc + 1]/data->MDomain[indexr + 1];
-				
-				dx = (u1 - u0)/2;
-
-				if( (rj==0) || (data->MDomain[indexr - data->rows] == 0) )
-					u0 = data->MImage[indexrc]/data->MDomain[indexr];
-				else
-					u0 = data->MImage[indexrc - data->rows]/data->MDomain[indexr - data->rows];
-
-				if( (rj== data->cols-1) || (data->MDomain[indexr + data->rows] == 0) )
-					u1 = data->MImage[indexrc]/data->MDomain[indexr];
-				else
-					u1 = data->MImage[indexrc + data->rows]/data->MDomain[indexr + data->rows];
-
-				dy = (u1 - u0)/2;
-				
-                
-				vsh[0] = vsh[0] + data->SKernel2[j] * dx * dx;
-				vsh[1] = vsh[1] + data->SKernel2[j] * dx * dy;
-				vsh[2] = vsh[2] + data->SKernel2[j] * dy * dy;
-				wh = wh + data->SKernel2[j];
-			}
-			vs[0] = vs[0] + data->SKernel2[i] * vsh[0];
-			vs[1] = vs[1] + data->SKernel2[i] * vsh[1];
-			vs[2] = vs[2] + data->SKernel2[i] * vsh[2];
-			w = w + data->SKernel2[i] * wh;
+			J = data->RowT + 4 * PixelIndex(data,ri,xj);
+			ST[0] = ST[0] + data->SKernel2[i] * J[0];
+			ST[1] = ST[1] + data->SKernel2[i] * J[1];
+			ST[2] = ST[2] + data->SKernel2[i] * J[2];
+			w = w + data->SKernel2[i] * J[3];
 		}
-		
-		if( data->convex == NULL )
-		{
-			ST[0] = ST[0] + vs[0]/w;
-			ST[1] = ST[1] + vs[1]/w;
-			ST[2] = ST[2] + vs[2]/w;
-		}
-        else
-		{
-			ST[0] = ST[0] + data->convex[c] * vs[0]/w;
-			ST[1] = ST[1] + data->convex[c] * vs[1]/w;
-			ST[2] = ST[2] + data->convex[c] * vs[2]/w;
-		}
-		
+		ST[0] = ST[0]/w;
+		ST[1] = ST[1]/w;
+		ST[2] = ST[2]/w;
+		return;
 	}
 
-	if(data->convex == NULL)
+	for(i = 0; i < data->lenSK2 ; i++)
 	{
-        double W = 1.0 / (data->channels);  
-		ST[0] = ST[0] * W;
-		ST[1] = ST[1] * W; 
-		ST[2] = ST[2] * W; 
+		ri = xi+r-i;
+		if( (ri < 0) || (ri >= data->rows) )
+			continue;
+
+		vsh[0] = 0;
+		vsh[1] = 0;
+		vsh[2] = 0;
+		wh = 0;
+		// from rj = xj+r down to xj-r, over the known pixels; these
+		// include all with a smaller T
+		// known, in runs b..e+1
+		b0 = KnownBit(data,ri,max(xj-r,0));
+		b1 = KnownBit(data,ri,min(xj+r,data->cols-1));
+		for( b = ScanKnownDown(data,b1,b0,1) ; b >= b0 ; b = ScanKnownDown(data,e,b0,1) )
+		for( e = ScanKnownDown(data,b,b0,0), rj = b - KnownBit(data,ri,0) ; rj > e - KnownBit(data,ri,0) ; rj-- )
+		{
+			j = xj+r-rj;
+
+            indexr = PixelIndex(data,ri,rj);
+            
+			if(data->Tfield[indexr] >= data->Tfield[indexx])
+				continue;
+
+            // cached unless InitGradients was not called
+            if( data->GradT != NULL )
+                J = data->GradT + 3 * indexr;
+            else
+            {
+                GradientTensor(data, ri, rj, Jh);
+                J = Jh;
+            }
+
+			vsh[0] = vsh[0] + data->SKernel2[j] * J[0];
+			vsh[1] = vsh[1] + data->SKernel2[j] * J[1];
+			vsh[2] = vsh[2] + data->SKernel2[j] * J[2];
+			wh = wh + data->SKernel2[j];
+		}
+		ST[0] = ST[0] + data->SKernel2[i] * vsh[0];
+		ST[1] = ST[1] + data->SKernel2[i] * vsh[1];
+		ST[2] = ST[2] + data->SKernel2[i] * vsh[2];
+		w = w + data->SKernel2[i] * wh;
 	}
+
+	ST[0] = ST[0]/w;
+	ST[1] = ST[1]/w;
+	ST[2] = ST[2]/w;
 }
 
-void SmoothUpdate(Data *data,int xi,int xj)
+// splats the known point (xi,xj) into MImage and MDomain and returns the
+// distance within which they changed
+static int SmoothSplat(Data *data, int xi, int xj)
 {
 	int yi,yj;
-	int i,j,c;
+	int c;
 	int s;
     int indexx;
     int indexy;
+    int sx,sy;
+    Real ki,w;
     
-    indexx = xj * data->rows + xi;
+    indexx = PixelIndex(data,xi,xj);
+    sx = SampleIndex(data,indexx,0);
     
     if( data->SKernel1 == NULL ) // i.e. sigma == 0
     {
         for(c = 0; c < data->channels ; c++)
-			data->MImage[indexx + c * data->size] = data->Image[indexx + c * data->size];  
+			data->MImage[sx + c * data->cstride] = data->Image[sx + c * data->cstride];
         
         data->MDomain[indexx] = 1;
-        return;
+        return 0;
     }
     
 	s = (data->lenSK1-1)/2;
 
-	for( yi = xi-s ; yi <= xi+s ; yi++)
-		for( yj = xj-s ; yj <= xj+s ; yj++)
+	for( yi = max(xi-s,0) ; yi <= min(xi+s,data->rows-1) ; yi++)
+	{
+		ki = data->SKernel1[xi-yi+s];
+		for( yj = max(xj-s,0) ; yj <= min(xj+s,data->cols-1) ; yj++)
 		{
-			if( (yi >= 0) && (yi < data->rows) && (yj >= 0) && (yj < data->cols) )
-			{
-				i = xi-yi+s;
-				j = xj-yj+s;
+			w = ki * data->SKernel1[xj-yj+s];
 
-                indexy = yj * data->rows + yi;
-                
-				for(c = 0; c < data->channels ; c++)
-                    data->MImage[indexy + c * data->size] += (data->SKernel1[i] * data->SKernel1[j] * data->Image[indexx + c * data->size]);
-				
-				data->MDomain[indexy] += (data->SKernel1[i] * data->SKernel1[j]);
-			}
+            indexy = PixelIndex(data,yi,yj);
+            sy = SampleIndex(data,indexy,0);
+            
+			for(c = 0; c < data->channels ; c++)
+                data->MImage[sy + c * data->cstride] += w * data->Image[sx + c * data->cstride];
+			
+			data->MDomain[indexy] += w;
 		}
+	}
+
+    return s;
+}
+
+void SmoothUpdate(Data *data,int xi,int xj)
+{
+    RefreshGradients(data,xi,xj,SmoothSplat(data,xi,xj));
+}
+
+// the points k0, k0+3, .. < k1 of ordered_points become known, as with
+// MarkKnown, SetDomain and SmoothUpdate one by one. The splats go in the
+// same order, but GradT is refreshed once over the union of their squares,
+// in parallel; it only depends on MImage and MDomain, so it ends up the
+// same. The row sums RowT are kept by differences and would add up in
+// another order, so with them the points go one by one, as they do when
+// there is no memory for the list. mark holds a bit per pixel index, zero
+// before and after.
+void SmoothUpdateLevel(Data *data, int k0, int k1, unsigned int *mark)
+{
+    int kk;
+    int i,j;
+    int d,n;
+    int yi,yj;
+    int index;
+    int *list = NULL;
+    size_t square,len;
+
+    if( k1 <= k0 )
+        return;
+
+    // pixels of GradT to refresh: a square of (2d+1)^2 per point, at most
+    // every pixel once
+    d = ((data->SKernel1 != NULL) ? (data->lenSK1-1)/2 : 0) + 1;
+    if( data->RowT == NULL )
+    {
+        square = (size_t) (2*d+1) * (size_t) (2*d+1);
+        len = (size_t) ((k1-k0)/3);
+        if( len >= (size_t) data->size / square )
+            len = (size_t) data->size;
+        else
+            len = len * square;
+        list = (int *) AllocMem(sizeof(int) * len);
+    }
+
+    // one by one with RowT, or without the memory for the list
+    if( list == NULL )
+    {
+        for( kk=k0 ; kk < k1 ; kk=kk+3 )
+        {
+            i = (int) (data->ordered_points[kk]);
+            j = (int) (data->ordered_points[kk+1]);
+            MarkKnown(data,i,j);
+            SetDomain(data,PixelIndex(data,i,j),1);
+            SmoothUpdate(data,i,j);
+        }
+        return;
+    }
+
+    n = 0;
+
+    for( kk=k0 ; kk < k1 ; kk=kk+3 )
+    {
+        i = (int) (data->ordered_points[kk]);
+        j = (int) (data->ordered_points[kk+1]);
+        MarkKnown(data,i,j);
+        SetDomain(data,PixelIndex(data,i,j),1);
+        SmoothSplat(data,i,j);
+
+        if( data->GradT == NULL )
+            continue;
+
+        for( yj = max(j-d,0) ; yj <= min(j+d,data->cols-1) ; yj++ )
+            for( yi = max(i-d,0) ; yi <= min(i+d,data->rows-1) ; yi++ )
+            {
+                index = PixelIndex(data,yi,yj);
+                if( (mark[index >> 5] >> (index & 31)) & 1 )
+                    continue;
+                mark[index >> 5] |= 1u << (index & 31);
+                list[n++] = index;
+            }
+    }
+
+    #pragma omp parallel for num_threads(NumThreads(data)) if( k1-k0 >= 3*PARALLEL_MIN_POINTS )
+    for( kk=0 ; kk < n ; kk++ )
+        RefreshGradient(data, PixelRow(data,list[kk]), PixelCol(data,list[kk]));
+
+    for( kk=0 ; kk < n ; kk++ )
+        mark[list[kk] >> 5] &= ~(1u << (list[kk] & 31));
+
+    FreeMem(list);
 }
 // end procs for inpainting
 
 // procs to compute the order
-void OrderByDistance(Data *data)
+// all pixels into the queue after InitTfield, the ones on the first boundary
+// are known
+template <class Queue>
+static void InsertBand(Data *data, Queue *H)
 {
-	hItem actual;
-	hItem *nbh[4];
-	Heap NarrowBand(data);
+	int i,j;
     int index;
+
+    for(i = 0; i < data->rows; i++)
+	{
+		for(j = 0; j < data->cols; j++)
+		{
+            index = PixelIndex(data,i,j);
+            
+			H->insert(index, data->Tfield[index]);
+
+			// first Boundary is known
+			if( (data->Flag[index] == BAND) && (data->Tfield[index] == 0) )
+				data->Flag[index] = TO_INPAINT;
+		}
+	}
+}
+
+// fast marching from the boundary of the hole. With MARCHING_UNTIDY a point
+// that leaves the queue below the largest T so far is ordered with that T,
+// so that the order stays sorted; data->order_deviation is the largest such
+// step. Its own T goes on into solve, and Tfield gets the ordered T once the
+// marching is done. Queue is Heap or UntidyHeap, so that the queue calls
+// in the loop are not virtual.
+template <class Queue>
+static void March(Data *data, Queue *NarrowBand)
+{
+	int actual;
+	int nbh[4];
 	int i = 0;
     int k,p;
-	
-    InitTfieldAndHeap(data, &NarrowBand);
+	int ai,aj;
+	Real Tmax = 0;
+
+    InitTfield(data);
+    InsertBand(data, NarrowBand);
 
     p = 0;
-	while(!NarrowBand.isempty())
+	while(!NarrowBand->isempty())
 	{
-		if (p++%300==0) gimp_progress_update(0.1+0.2*(gdouble)p/(gdouble)(data->nof_points2inpaint));
-		actual = NarrowBand.extract();
-        
-        index = actual.j * data->rows + actual.i;
+		if (p++%300==0) ReportProgress(data, 0.1+0.2*(double)p/(double)(data->nof_points2inpaint));
+		actual = NarrowBand->extract();
+
+        ai = PixelRow(data,actual);
+        aj = PixelCol(data,actual);
        
-        data->ordered_points[i]   = actual.i;
-        data->ordered_points[i+1] = actual.j;
-        data->ordered_points[i+2] = actual.T;
+        data->ordered_points[i]   = ai;
+        data->ordered_points[i+1] = aj;
+        data->ordered_points[i+2] = data->Tfield[actual];
+
+		if( data->marching == MARCHING_UNTIDY )
+		{
+			if( data->Tfield[actual] < Tmax )
+			{
+				data->order_deviation = max(data->order_deviation, Tmax - data->Tfield[actual]);
+				data->ordered_points[i+2] = Tmax;
+			}
+			Tmax = data->ordered_points[i+2];
+		}
         i = i+3;
 
-		data->Tfield[index].flag = TO_INPAINT;
+		data->Flag[actual] = TO_INPAINT;
 
-		if(actual.i == 0) // top
-			nbh[0] = NULL;
+		if(ai == 0) // top
+			nbh[0] = -1;
 		else
-			nbh[0] = &(data->Tfield[index - 1]);
+			nbh[0] = actual - data->istride;
         
-		if(actual.i == data->rows - 1) // bottom
-			nbh[1] = NULL;
+		if(ai == data->rows - 1) // bottom
+			nbh[1] = -1;
 		else
-			nbh[1] = &(data->Tfield[index + 1]);
+			nbh[1] = actual + data->istride;
         
-		if(actual.j == 0) // left
-			nbh[2] = NULL;
+		if(aj == 0) // left
+			nbh[2] = -1;
 		else
-			nbh[2] = &(data->Tfield[index - data->rows]);
+			nbh[2] = actual - data->jstride;
         
-		if(actual.j == data->cols - 1) // right
-			nbh[3] = NULL;
+		if(aj == data->cols - 1) // right
+			nbh[3] = -1;
 		else
-			nbh[3] = &(data->Tfield[index + data->rows]);
+			nbh[3] = actual + data->jstride;
 
 		for(k=0 ; k<4; k++)
 		{
-			if(nbh[k] != NULL)
+			if(nbh[k] != -1)
 			{
-				if(nbh[k]->flag == INSIDE)
-					nbh[k]->flag = BAND;
-				if(nbh[k]->flag == BAND)
-				{
-					hItem temp = *nbh[k];
-					temp.T = solve(data, temp.i, temp.j);
-					NarrowBand.insert(temp);
-				}
+				if(data->Flag[nbh[k]] == INSIDE)
+					data->Flag[nbh[k]] = BAND;
+				if(data->Flag[nbh[k]] == BAND)
+					NarrowBand->insert(nbh[k], solve(data, PixelRow(data,nbh[k]), PixelCol(data,nbh[k])));
 			}
 		}
 	}
+
+	// the points left out are not inpainted
+	if( NarrowBand->outofmemory() )
+	{
+		ReportMessage(data, "Out of memory in the fast marching. Only part of the hole is inpainted. \n");
+		data->nof_points2inpaint = i/3;
+	}
+
+	if( data->marching == MARCHING_UNTIDY )
+		for( i=0 ; i < 3 * data->nof_points2inpaint ; i=i+3 )
+			data->Tfield[PixelIndex(data, (int) data->ordered_points[i], (int) data->ordered_points[i+1])] = data->ordered_points[i+2];
 }
 
-void InitTfieldAndHeap(Data *data, Heap *H)
+// only the queue of data->marching is built
+void OrderByDistance(Data *data)
+{
+	data->order_deviation = 0;
+	if( data->marching == MARCHING_SWEEPS )
+	{
+		OrderBySweeps(data);
+		return;
+	}
+
+	if( data->marching == MARCHING_UNTIDY )
+	{
+		UntidyHeap Untidy(data);
+		March(data, &Untidy);
+	}
+	else
+	{
+		Heap Exact(data);
+		March(data, &Exact);
+	}
+}
+
+// T of the hole before the marching: 0 on its boundary, or Inf where the
+// boundary is not taken with thresh; Inf inside and -1 on the known pixels
+void InitTfield(Data *data)
 {
-	int i,j;
-    int index;
-    hItem item;
     int err =0;
     
     // Initialization of boundary points
@@ -525,25 +1572,14 @@ void InitTfieldAndHeap(Data *data, Heap *H)
     {
         TfieldDefaultInitialization(data);
         
-        g_message("Threshold aplha too large. Falling back to euclidean distance. \n");
+        ReportMessage(data, "Threshold aplha too large. Falling back to euclidean distance. \n");
     }
-        
-    
-    // Heap Initialization
-    for(i = 0; i < data->rows; i++)
-	{
-		for(j = 0; j < data->cols; j++)
-		{
-            index = j * data->rows + i;
-            
-			item = data->Tfield[index];
-			H->insert(item);
+}
 
-			// first Boundary is known
-			if( (data->Tfield[index].flag == BAND) && (data->Tfield[index].T == 0) )
-				data->Tfield[index].flag = TO_INPAINT;
-		}
-	}
+void InitTfieldAndHeap(Data *data, Heap *H)
+{
+    InitTfield(data);
+    InsertBand(data, H);
 }
 
 void TfieldDefaultInitialization(Data *data)
@@ -555,31 +1591,29 @@ void TfieldDefaultInitialization(Data *data)
 	{
 		for(j = 0; j < data->cols ; j++)
 		{
-            index = j * data->rows + i;
+            index = PixelIndex(data,i,j);
             
-			data->Tfield[index].i = i;
-			data->Tfield[index].j = j;
-			data->Tfield[index].hpos = -1;
+			data->hpos[index] = -1;
 
-			if(data->Domain[index] == 0)
+			if(!InDomain(data,index))
 			{
-				data->Tfield[index].flag = BAND;
-				data->Tfield[index].T = 0;
+				data->Flag[index] = BAND;
+				data->Tfield[index] = 0;
 			
-				if(    ((i==0) || (data->Domain[ index-1 ] == 0)) 
-					&& ((i==data->rows-1) || (data->Domain[ index+1 ] == 0)) 
-					&& ((j==0) || (data->Domain[ index - data->rows ] == 0)) 
-					&& ((j==data->cols-1) || (data->Domain[ index + data->rows ] == 0))  )
+				if(    ((i==0) || !InDomain(data, index - data->istride)) 
+					&& ((i==data->rows-1) || !InDomain(data, index + data->istride)) 
+					&& ((j==0) || !InDomain(data, index - data->jstride)) 
+					&& ((j==data->cols-1) || !InDomain(data, index + data->jstride))  )
 				{
-					data->Tfield[index].flag = INSIDE;
-					data->Tfield[index].T = Inf;
+					data->Flag[index] = INSIDE;
+					data->Tfield[index] = Inf;
 				}
 
 			}
 			else
 			{
-				data->Tfield[index].flag = KNOWN;
-				data->Tfield[index].T = -1; 
+				data->Flag[index] = KNOWN;
+				data->Tfield[index] = -1; 
 			}
 
 		}
@@ -607,28 +1641,28 @@ int TfieldAdaptInitializationToImage(Data *data)
 	{
 		for(j = 0; j < data->cols ; j++)
 		{
-            index = j * data->rows + i;
+            index = PixelIndex(data,i,j);
             
-			if(data->Tfield[index].flag == BAND)
+			if(data->Flag[index] == BAND)
 			{               
                 // boundary normal
                 if( i==0 )
-                    normaldir[0] = data->MDomain[index+1]-data->MDomain[index];
+                    normaldir[0] = data->MDomain[index + data->istride]-data->MDomain[index];
                 else if( i==data->rows-1 )
-                    normaldir[0] = data->MDomain[index]-data->MDomain[index-1];
+                    normaldir[0] = data->MDomain[index]-data->MDomain[index - data->istride];
                 else
                 {
-                    normaldir[0] = data->MDomain[index+1]-data->MDomain[index-1];
+                    normaldir[0] = data->MDomain[index + data->istride]-data->MDomain[index - data->istride];
                     normaldir[0] = normaldir[0] * 0.5;
                 }
                 
                 if( j==0 )
-                    normaldir[1] = data->MDomain[index + data->rows]-data->MDomain[index];
+                    normaldir[1] = data->MDomain[index + data->jstride]-data->MDomain[index];
                 else if( j==data->cols-1 )
-                    normaldir[1] = data->MDomain[index]-data->MDomain[index - data->rows];
+                    normaldir[1] = data->MDomain[index]-data->MDomain[index - data->jstride];
                 else
                 {
-                    normaldir[1] = data->MDomain[index + data->rows]-data->MDomain[index - data->rows];
+                    normaldir[1] = data->MDomain[index + data->jstride]-data->MDomain[index - data->jstride];
                     normaldir[1] = normaldir[1] * 0.5;
                 }
                 
@@ -645,13 +1679,13 @@ int TfieldAdaptInitializationToImage(Data *data)
                 
 				if( Dx <= data->thresh  )  
 				{
-					data->Tfield[index].flag = INSIDE; 
-					data->Tfield[index].T = Inf;
+					data->Flag[index] = INSIDE; 
+					data->Tfield[index] = Inf;
 				}
                 else
                 {
-                    data->Tfield[index].flag = BAND;
-                    data->Tfield[index].T = 0;
+                    data->Flag[index] = BAND;
+                    data->Tfield[index] = 0;
                     countInitialPoints++;
                 }
                 
@@ -681,27 +1715,27 @@ double solve(Data *data, int i,int j)
 	double F = 1;
     int index;
     
-    index = j * data->rows + i;
+    index = PixelIndex(data,i,j);
     
-	if( (i == 0) || (data->Domain[index-1] == 1) )
+	if( (i == 0) || InDomain(data, index - data->istride) )
 		u[0] = Inf;
 	else
-		u[0] = (data->Tfield[index-1].T);
+		u[0] = (data->Tfield[index - data->istride]);
 
-	if( (i == data->rows - 1) || (data->Domain[index+1] == 1) )
+	if( (i == data->rows - 1) || InDomain(data, index + data->istride) )
 		u[1] = Inf;
 	else
-		u[1] = (data->Tfield[index+1].T);
+		u[1] = (data->Tfield[index + data->istride]);
 
-	if( (j == 0) || (data->Domain[index - data->rows] == 1) )
+	if( (j == 0) || InDomain(data, index - data->jstride) )
 		u[2] = Inf;
 	else
-		u[2] = (data->Tfield[index - data->rows].T);
+		u[2] = (data->Tfield[index - data->jstride]);
 
-	if( (j == data->cols - 1) || (data->Domain[index + data->rows] == 1) )
+	if( (j == data->cols - 1) || InDomain(data, index + data->jstride) )
 		u[3] = Inf;
 	else
-		u[3] = (data->Tfield[index + data->rows].T);
+		u[3] = (data->Tfield[index + data->jstride]);
     
 
 	ux = min(u[0],u[1]);
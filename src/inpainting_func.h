@@ -20,11 +20,63 @@
 
 
 #include <math.h>
+#include <stddef.h>
+#include <string.h>
 #include <limits>
+#include "inpainting_config.h"
 struct Data;
 
+// scalar type of the image, domain and time buffers; float halves the memory
+// and bandwidth of the engine. configure --enable-single-precision sets it
+// in inpainting_config.h, which is installed with this header.
+#ifdef INPAINT_SINGLE_PRECISION
+typedef float Real;
+#else
+typedef double Real;
+#endif
+
 #include "Heap.h"
 
+// callbacks used by the engine to report progress and messages
+typedef void (*ProgressFunc)(double fraction, void *user_data);
+typedef void (*MessageFunc)(const char *message, void *user_data);
+
+// stages of InpaintByOrder, reported when they are done: STAGE_INIT the
+// set-up, STAGE_UPDATE the SmoothUpdateLevel of a level of points points,
+// STAGE_LEVEL the inpainting of such a level. For timings, see bench.cpp.
+enum Stage {STAGE_INIT,STAGE_UPDATE,STAGE_LEVEL};
+typedef void (*StageFunc)(int stage, int points, void *user_data);
+
+// SCHEDULE_LEVELS: points of one T-level in parallel
+// SCHEDULE_WAVES: dependency waves across levels, same result as serial
+enum Scheduler {SCHEDULE_LEVELS,SCHEDULE_WAVES};
+
+// MARCHING_EXACT: OrderByDistance marches over a Heap, in the order of T
+// MARCHING_UNTIDY: over an UntidyHeap, in linear time; the order of T up to
+// about HEAP_BUCKET_WIDTH
+// MARCHING_SWEEPS: T by sweeps over tiles in parallel, see OrderBySweeps
+enum Marching {MARCHING_EXACT,MARCHING_UNTIDY,MARCHING_SWEEPS};
+
+// LAYOUT_PLANAR: column-major planes, pixel (i,j) at j*rows + i and its
+// channel c at c*size further
+// LAYOUT_INTERLEAVED: row-major pixels at i*cols + j with the channels of a
+// pixel next to each other, as in GIMP pixel rows
+enum Layout {LAYOUT_PLANAR,LAYOUT_INTERLEAVED};
+
+// PRECISION_EXACT: weights with the exp of the math library
+// PRECISION_FAST: weights with FastExp, relative error below 1e-8
+// PRECISION_FIXED: for 8 bit images, integer weights 1 + FIXED_WSCALE * w
+// and sums over ImageQ, the image in 16 bit fixed point with FIXED_SHIFT
+// fractional bits
+enum Precision {PRECISION_EXACT,PRECISION_FAST,PRECISION_FIXED};
+
+#define FIXED_SHIFT   7
+#define FIXED_WSCALE  32766
+
+// SMOOTHING_FIR: SmoothImage with the kernel SKernel1, cut off at 2 sigma
+// SMOOTHING_RECURSIVE: SmoothImage with the recursive Gaussian of Young and
+// van Vliet, at a cost per pixel independent of sigma
+enum Smoothing {SMOOTHING_FIR,SMOOTHING_RECURSIVE};
 
 
 struct Data
@@ -35,17 +87,26 @@ struct Data
     int xmin,xmax,ymin,ymax;
     int channels;
     int size;
-    double *Image;
-    double *MImage;
+    int layout;
+    int istride,jstride; // pixel index of (i,j), set by AllocImage
+    int pstride,cstride; // Image/MImage entry of channel c at a pixel index
+    Real *Image;
+    Real *MImage;
+    short *ImageQ; // PRECISION_FIXED only, see InitFixed
+    Real *GradT; // 3 per pixel index, with guidance, see InitGradients
+    Real *RowT; // 4 per pixel index, window row sums of GradT, see InitGradients
 
     // data domain info
-    double *Domain;
-    double *MDomain;
+    unsigned int *Domain; // bitmap, see InDomain
+    Real *MDomain;
 
-    // time info
-    hItem **heap;
-    hItem *Tfield;
-    double *ordered_points;
+    // time info, one entry per pixel: arrival time T, Label and position in
+    // the heap (-1 if not in it)
+    Real *Tfield;
+    unsigned char *Flag;
+    int *hpos;
+    unsigned int *Known; // bitmap of Flag KNOWN, see MarkKnown
+    Real *ordered_points;
     int *inpaint_index;
     int nof_points2inpaint;
 
@@ -59,38 +120,210 @@ struct Data
     double delta_quant4;
     double *convex;
 
-    // smoothing kernels and buffer
+    // smoothing kernels
     int lenSK1;
     int lenSK2;
-    double *SKernel1;
-    double *SKernel2;
-    double *Shelp;
+    Real *SKernel1;
+    Real *SKernel2;
 
     // inpaint buffer
-    double *Ihelp;
+    Real *Ihelp;
+
+    // neighbourhood of inpaintPoint: the offsets (vi,vj) in the disc of
+    // radius data->radius without the centre, with their length r, in the
+    // order of the scan over the square; set by SetStencil for the radius
+    // radiusStencil.
+    // Row vi = r - radius of the disc starts at entry StencilRow[r].
+    int lenStencil;
+    int radiusStencil;
+    int *StencilRow;
+    int *StencilI;
+    int *StencilJ;
+    Real *StencilR;
 
     // flags
     int ordergiven;
     int guidance;
     int inpaint_undefined;
+    int marching;
+    double order_deviation; // largest step back in T of an untidy order
+
+    // parallel inpainting
+    int threads; // 0: as many as OpenMP provides
+    double tband; // width of the relaxed T-bands, 0: exact order
+    int scheduler;
+
+    int smoothing;
+    int precision;
+    double cutoff; // neighbours with exp(-z/2) below are skipped, 0: none
+
+    // far field: neighbours beyond nearfield are taken from the pyramid
+    // Pyramid[1..levels] of sums over the known pixels, see
+    // inpainting_far.cpp; 0: all neighbours exact
+    int nearfield;
+    int levels;
+    Real **Pyramid;
 
     // extension
     double *GivenGuidanceT;
+
+    // callbacks, may be NULL
+    ProgressFunc progress;
+    MessageFunc message;
+    StageFunc stage;
+    void *callback_data;
 };
 
+// pixel index of (i,j), used for the image as well as for the per pixel
+// arrays, and its inverse
+inline int PixelIndex(const Data *data, int i, int j)
+{
+    return i * data->istride + j * data->jstride;
+}
+
+inline int PixelRow(const Data *data, int index)
+{
+    return (index / data->istride) % data->rows;
+}
+
+inline int PixelCol(const Data *data, int index)
+{
+    return (index / data->jstride) % data->cols;
+}
+
+// position of channel c of the pixel index in Image and MImage
+inline int SampleIndex(const Data *data, int index, int c)
+{
+    return index * data->pstride + c * data->cstride;
+}
+
+// Domain holds one bit per pixel, set where the image is known. Bits are set
+// atomically since points of one level are inpainted in parallel.
+#define DOMAIN_WORDS(size)    (((size) + 31) >> 5)
+
+inline int InDomain(const Data *data, int index)
+{
+    return (data->Domain[index >> 5] >> (index & 31)) & 1;
+}
+
+inline void SetDomain(Data *data, int index, int known)
+{
+    unsigned int bit = 1u << (index & 31);
+
+    if( known )
+    {
+#ifdef _OPENMP
+        #pragma omp atomic
+#endif
+        data->Domain[index >> 5] |= bit;
+    }
+    else
+    {
+#ifdef _OPENMP
+        #pragma omp atomic
+#endif
+        data->Domain[index >> 5] &= ~bit;
+    }
+}
+
+// Known holds one bit per pixel with Flag KNOWN. Unlike Domain its bits go
+// row by row in both layouts, so the pixels of a row of a window are adjacent
+// bits and unknown runs are skipped a word at a time. Set up by InitKnown.
+inline int KnownBit(const Data *data, int i, int j)
+{
+    return i * data->cols + j;
+}
+
+// exp(x) for the weights with PRECISION_FAST and PRECISION_FIXED, with a
+// relative error below 1e-8 for -708 <= x <= 709. Below that it is at most
+// exp(-708), and 0 for x <= -709.1, -Inf and NaN; above 709 it is exp(709).
+// x = n ln2 + r with |r| <= ln2/2, exp(r) by its Taylor polynomial of degree
+// 7, 2^n assembled in the exponent bits. There are no calls and no branches,
+// which keep loops from being vectorized: the clamp is two selects, which
+// compile to min and max instructions where fmin and fmax are calls.
+inline double FastExp(double x)
+{
+    const double shift = 6755399441055744.0 + 1023; // 1.5*2^52, n + 1023 ends up in the low bits
+    double xc,n,r,p,scale;
+    unsigned long long bits;
+
+    // x clamped to [-709.1,709], NaN to -709.1; there n + 1023 = 0 gives the
+    // scale 0
+    xc = (x > -709.1) ? x : -709.1;
+    xc = (xc < 709.0) ? xc : 709.0;
+
+    n = xc * 1.4426950408889634 + shift;
+    memcpy(&bits, &n, sizeof(bits));
+    n = n - shift;
+    r = xc - n * 6.93147180369123816490e-01; // ln2 in two parts, the first
+    r = r - n * 1.90821492927058770002e-10;  // one exact in n ln2
+
+    p = 1 + r*(1 + r*(1.0/2 + r*(1.0/6 + r*(1.0/24 + r*(1.0/120 + r*(1.0/720 + r*(1.0/5040)))))));
+
+    bits = bits << 52;
+    memcpy(&scale, &bits, sizeof(scale));
+
+    return p * scale;
+}
+
+// scale * w of PRECISION_FIXED clamped to [0,1], NaN to 0, so that the
+// conversion of FIXED_WSCALE times it to int is defined for any weight
+inline double FixedFraction(double scale, double w)
+{
+    double f = scale * w;
+
+    f = (f > 0) ? f : 0;
+    return (f < 1) ? f : 1;
+}
+
+// data handling
+void *AllocMem(size_t n);
+void FreeMem(void *p);
+void SetDefaults(Data *data);
+void AllocImage(Data *data);
+void AllocBuffers(Data *data);
+void SetImageRow(Data *data, int i, const unsigned char *pixel, int image_channels, const unsigned char *mpixel, int mask_channels);
+void GetImageRow(Data *data, int i, unsigned char *pixel, int image_channels);
+void SetKernels(Data *data);
+void SetStencil(Data *data);
+void ClearMemory(Data *data);
+void ReportProgress(Data *data, double fraction);
+void ReportMessage(Data *data, const char *message);
+void ReportStage(Data *data, int stage, int points);
+
+// engine
+
 void InpaintImage(Data *data);
+void InpaintComponents(Data *data);
 void SmoothImage(Data *data);
 void OrderByDistance(Data *data);
+void InitTfield(Data *data);
 void InitTfieldAndHeap(Data *data, Heap *H);
+void OrderBySweeps(Data *data);
 void TfieldDefaultInitialization(Data *data);
 int TfieldAdaptInitializationToImage(Data *data);
 double solve(Data *data, int i,int j);
+void InitKnown(Data *data);
+void MarkKnown(Data *data, int i, int j);
+void InitFixed(Data *data);
+void InitGradients(Data *data);
+void AddKnownToRows(Data *data, int i, int j);
 void InpaintByOrder(Data *data);
+void QuantizeOrder(Data *data, double tband);
+void InpaintByWaves(Data *data);
+void InitPyramid(Data *data);
+void AddToPyramid(Data *data, int i, int j);
+void FarField(Data *data, int xi, int xj, const double *G, Real zfac, Real *Ihelp, Real *W, Real *Wk, Real *scale);
+void FixedRescale(Data *data, Real w, Real *scale, Real *Ihelp, Real *W);
 void SmoothUpdate(Data *data,int xi,int xj);
+void SmoothUpdateLevel(Data *data, int k0, int k1, unsigned int *mark);
 void inpaintPoint(Data *data,int i,int j);
+void inpaintPoint(Data *data,int i,int j,Real *Ihelp);
 void Guidance(Data *data, int xi, int xj, double *G);
 void ModStructureTensor(Data *data, int xi,int xj, double *st);
 double euclidean_norm(double *v);
+int NumThreads(Data *data);
+int ThreadNum(void);
 
 
 #endif /* INPAINTING_FUNC_H_ */
@@ -0,0 +1,200 @@
+/* inpainting_sched.cpp  --- inpaintBCT
+ * Copyright (C) 2013 Thomas März (maerz@maths.ox.ac.uk)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Dependency scheduling of InpaintByOrder.
+ *
+ * The serial algorithm is a sequence of two kinds of events per point p:
+ *   I(p)  inpaintPoint at p, reads Image and flags within data->radius and,
+ *         with guidance, MImage/MDomain within lenSK2/2 + 1 (GradT within
+ *         lenSK2/2),
+ *   S(p)  p becomes KNOWN and SmoothUpdate splats it into MImage/MDomain
+ *         within lenSK1/2 and refreshes GradT within lenSK1/2 + 1; happens
+ *         once the level of p is complete.
+ * Two events conflict if one of them writes what the other one touches.
+ * Every event gets a wave one larger than the largest wave of the earlier
+ * events it conflicts with. Running the waves one after the other, with the
+ * events of a wave in parallel, every event sees exactly the state it sees
+ * in the serial run, so the result is bit-identical to InpaintByOrder.
+ */
+
+#include "inpainting_func.h"
+
+#include <cstdlib>
+
+#define min(a,b)          ((a)<(b)?(a):(b))
+#define max(a,b)          ((a)>(b)?(a):(b))
+
+#define EVENT_INPAINT 0
+#define EVENT_UPDATE  1
+
+
+// largest entry of the grid W in the square of half width d around (i,j)
+static int BoxMax(Data *data, int *W, int i, int j, int d)
+{
+    int yi,yj;
+    int i0,i1;
+    int m = 0;
+    int *col;
+
+    i0 = max(i-d,0);
+    i1 = min(i+d,data->rows-1);
+
+    for( yj = max(j-d,0) ; yj <= min(j+d,data->cols-1) ; yj++ )
+    {
+        col = W + yj * data->jstride;
+        for( yi = i0 ; yi <= i1 ; yi++ )
+            m = max(m, col[yi * data->istride]);
+    }
+    return m;
+}
+
+static void RunEvent(Data *data, int event, Real *Ihelp)
+{
+    int k = 3 * (event >> 1);
+    int i = (int) (data->ordered_points[k]);
+    int j = (int) (data->ordered_points[k+1]);
+    int index;
+
+    if( (event & 1) == EVENT_INPAINT )
+        inpaintPoint(data,i,j,Ihelp);
+    else
+    {
+        index = PixelIndex(data,i,j);
+        MarkKnown(data,i,j);
+        SetDomain(data,index,1);
+        SmoothUpdate(data,i,j);
+    }
+}
+
+void InpaintByWaves(Data *data)
+{
+    int stop;
+    int k,kk,kold,knext;
+    int i,j;
+    int index;
+    int s,r;
+    int dist_inpaint,dist_update;
+    int nevents,e,w;
+    int maxwave;
+    int nthreads;
+    Real Tact;
+    int *events;
+    int *wave;
+    int *order;
+    int *start;
+    int *WI;
+    int *WS;
+    Real *Ihelp;
+
+    stop = 3 * data->nof_points2inpaint;
+
+    // reach of the events
+    s = (data->SKernel1 != NULL) ? (data->lenSK1-1)/2 : 0;
+    r = (data->guidance == 1) ? (data->lenSK2-1)/2 + 1 : 0;
+    dist_inpaint = max(data->radius, r + s); // between I and S
+    dist_update = 2 * s;                     // between two S
+    if( data->GradT != NULL )
+        dist_update = 2 * s + 2;             // GradT refreshed within s+1
+    if( data->RowT != NULL )
+        dist_update = 2 * s + 2 + (data->lenSK2-1); // and its rows within lenSK2/2
+
+    events = (int *) AllocMem(sizeof(int) * 2 * data->nof_points2inpaint);
+    wave = (int *) AllocMem(sizeof(int) * 2 * data->nof_points2inpaint);
+    WI = (int *) calloc(data->size, sizeof(int));
+    WS = (int *) calloc(data->size, sizeof(int));
+
+    // serial event sequence and its waves; the I events of one level do not
+    // conflict, and WI, WS hold the wave of the I and S event at a pixel
+    nevents = 0;
+    maxwave = 0;
+    kold = 0;
+    for( k=0 ; k < stop ; k=knext )
+    {
+        Tact = data->ordered_points[k+2];
+        for( knext=k+3 ; (knext < stop) && (data->ordered_points[knext+2] <= Tact) ; knext=knext+3 );
+
+        for( kk=kold ; kk < k ; kk=kk+3 )
+        {
+            i = (int) (data->ordered_points[kk]);
+            j = (int) (data->ordered_points[kk+1]);
+            index = PixelIndex(data,i,j);
+
+            w = 1 + max( BoxMax(data,WI,i,j,dist_inpaint), BoxMax(data,WS,i,j,dist_update) );
+            WS[index] = w;
+            events[nevents] = 2 * (kk/3) + EVENT_UPDATE;
+            wave[nevents++] = w;
+            maxwave = max(maxwave,w);
+        }
+        kold = k;
+
+        for( kk=k ; kk < knext ; kk=kk+3 )
+        {
+            i = (int) (data->ordered_points[kk]);
+            j = (int) (data->ordered_points[kk+1]);
+            index = PixelIndex(data,i,j);
+
+            w = 1 + BoxMax(data,WS,i,j,dist_inpaint);
+            WI[index] = w;
+            events[nevents] = 2 * (kk/3) + EVENT_INPAINT;
+            wave[nevents++] = w;
+            maxwave = max(maxwave,w);
+        }
+    }
+
+    free(WI);
+    free(WS);
+
+    // sort the events by wave
+    start = (int *) calloc(maxwave + 2, sizeof(int));
+    order = (int *) AllocMem(sizeof(int) * nevents);
+    for( e=0 ; e < nevents ; e++ )
+        start[wave[e] + 1]++;
+    for( w=1 ; w <= maxwave + 1 ; w++ )
+        start[w] += start[w-1];
+    for( e=0 ; e < nevents ; e++ )
+        order[start[wave[e]]++] = events[e];
+    for( w=maxwave ; w > 0 ; w-- )
+        start[w] = start[w-1];
+    start[0] = 0;
+
+    FreeMem(events);
+    FreeMem(wave);
+
+    // run the waves
+    nthreads = NumThreads(data);
+    Ihelp = (Real *) AllocMem(sizeof(Real) * data->channels * nthreads);
+
+    #pragma omp parallel private(w,e) num_threads(nthreads)
+    {
+        Real *ThreadIhelp = Ihelp + ThreadNum() * data->channels;
+
+        for( w=1 ; w <= maxwave ; w++ )
+        {
+            #pragma omp master
+            if( w % 100 == 0 )
+                ReportProgress(data, 0.3 + 0.6*(double)start[w]/(double)nevents);
+
+            #pragma omp for schedule(dynamic,4)
+            for( e=start[w] ; e < start[w+1] ; e++ )
+                RunEvent(data, order[e], ThreadIhelp);
+        }
+    }
+
+    FreeMem(Ihelp);
+    FreeMem(order);
+    free(start);
+}
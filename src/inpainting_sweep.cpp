@@ -0,0 +1,234 @@
+/* inpainting_sweep.cpp  --- inpaintBCT
+ * Copyright (C) 2013 Thomas März (maerz@maths.ox.ac.uk)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Parallel ordering by distance.
+ *
+ * OrderByDistance marches the front into the hole one point at a time. With
+ * data->marching == MARCHING_SWEEPS, OrderBySweeps computes T as the fixed
+ * point of T = min(T, solve) instead, by the block fast iterative method: the
+ * hole is cut into tiles of SWEEP_TILE x SWEEP_TILE pixels, an active tile
+ * is swept in the four diagonal directions until T stops decreasing, and it
+ * then activates the neighbour tiles across the sides where T went down.
+ *
+ * The tiles are coloured like a checkerboard and the active tiles of one
+ * colour are swept in parallel. solve reads the four neighbours of a pixel
+ * only, so a tile reads the other colour at its sides and never a tile that
+ * is being swept: T does not depend on the number of threads.
+ *
+ * The points are then sorted by T into ordered_points, counted into buckets
+ * of width 1/SWEEP_BUCKETS first and each bucket sorted on its own.
+ */
+
+#include "inpainting_func.h"
+
+#include <cstring>
+#include <algorithm>
+
+#define Inf               std::numeric_limits<double>::infinity()
+#define min(a,b)          ((a)<(b)?(a):(b))
+#define max(a,b)          ((a)>(b)?(a):(b))
+
+#define SWEEP_TILE 64
+// a decrease of T by at most this relative to T is not a change; it is
+// kept, but neither sweeps the tile again nor wakes its neighbours
+#define SWEEP_TOL 1e-6
+// buckets per unit of T for the sort
+#define SWEEP_BUCKETS 16
+
+#define SIDE_TOP    1
+#define SIDE_BOTTOM 2
+#define SIDE_LEFT   4
+#define SIDE_RIGHT  8
+
+// sweeps over the hole pixels of rows i0..i1-1 and columns j0..j1-1 until T
+// no longer changes; returns the sides where it changed
+static int SweepTile(Data *data, int i0, int i1, int j0, int j1)
+{
+	int i,j,d;
+	int di,dj;
+	int ib,ie,jb,je;
+	int index;
+	int changed;
+	int sides = 0;
+	double T;
+
+	do
+	{
+		changed = 0;
+		for( d=0 ; d<4 ; d++ )
+		{
+			di = (d & 1) ? -1 : 1;
+			dj = (d & 2) ? -1 : 1;
+			ib = (di > 0) ? i0 : i1-1;
+			ie = (di > 0) ? i1 : i0-1;
+			jb = (dj > 0) ? j0 : j1-1;
+			je = (dj > 0) ? j1 : j0-1;
+
+			for( i=ib ; i!=ie ; i+=di )
+				for( j=jb ; j!=je ; j+=dj )
+				{
+					index = PixelIndex(data,i,j);
+					if( InDomain(data, index) )
+						continue;
+
+					T = solve(data,i,j);
+					if( T >= data->Tfield[index] )
+						continue;
+
+					if( data->Tfield[index] - T > SWEEP_TOL * (1 + T) )
+					{
+						changed = 1;
+						if( i == i0 )   sides |= SIDE_TOP;
+						if( i == i1-1 ) sides |= SIDE_BOTTOM;
+						if( j == j0 )   sides |= SIDE_LEFT;
+						if( j == j1-1 ) sides |= SIDE_RIGHT;
+					}
+					data->Tfield[index] = T;
+				}
+		}
+	} while( changed );
+
+	return sides;
+}
+
+static void Activate(int *active, int t)
+{
+	#pragma omp atomic
+	active[t] |= 1;
+}
+
+// items hold the raster position row * cols + col instead of the pixel
+// index, so that points with equal T come in the same order in both layouts
+static bool Earlier(const HeapItem &a, const HeapItem &b)
+{
+	return (a.T < b.T) || ((a.T == b.T) && (a.index < b.index));
+}
+
+void OrderBySweeps(Data *data)
+{
+	int tiles_i = (data->rows + SWEEP_TILE - 1) / SWEEP_TILE;
+	int tiles_j = (data->cols + SWEEP_TILE - 1) / SWEEP_TILE;
+	int ntiles = tiles_i * tiles_j;
+	int nthreads = NumThreads(data);
+	int *active;
+	unsigned char *hole;
+	int *start;
+	HeapItem *items;
+	int nbuckets;
+	int colour,any;
+	int i,j,k,t;
+	int index;
+	Real Tmax = 0;
+
+	InitTfield(data);
+	ReportProgress(data, 0.1);
+
+	active = (int *) AllocMem(sizeof(int) * ntiles);
+	hole = (unsigned char *) AllocMem(sizeof(unsigned char) * ntiles);
+	memset(hole, 0, sizeof(unsigned char) * ntiles);
+
+	for( i=0 ; i < data->rows ; i++ )
+		for( j=0 ; j < data->cols ; j++ )
+			if( !InDomain(data, PixelIndex(data,i,j)) )
+				hole[(i / SWEEP_TILE) * tiles_j + j / SWEEP_TILE] = 1;
+
+	for( t=0 ; t < ntiles ; t++ )
+		active[t] = hole[t];
+
+	// rounds over both colours until no tile is active
+	do
+	{
+		any = 0;
+		for( colour=0 ; colour<2 ; colour++ )
+		{
+			#pragma omp parallel for num_threads(nthreads) schedule(dynamic) reduction(|:any)
+			for( t=0 ; t < ntiles ; t++ )
+			{
+				int ti = t / tiles_j;
+				int tj = t % tiles_j;
+				int sides;
+
+				if( ((ti + tj) & 1) != colour || !active[t] )
+					continue;
+				active[t] = 0;
+				any = 1;
+
+				sides = SweepTile(data, ti * SWEEP_TILE, min((ti+1) * SWEEP_TILE, data->rows),
+				                        tj * SWEEP_TILE, min((tj+1) * SWEEP_TILE, data->cols));
+
+				if( (sides & SIDE_TOP) && ti > 0 && hole[t - tiles_j] )
+					Activate(active, t - tiles_j);
+				if( (sides & SIDE_BOTTOM) && ti < tiles_i-1 && hole[t + tiles_j] )
+					Activate(active, t + tiles_j);
+				if( (sides & SIDE_LEFT) && tj > 0 && hole[t - 1] )
+					Activate(active, t - 1);
+				if( (sides & SIDE_RIGHT) && tj < tiles_j-1 && hole[t + 1] )
+					Activate(active, t + 1);
+			}
+		}
+	} while( any );
+
+	FreeMem(active);
+	FreeMem(hole);
+	ReportProgress(data, 0.2);
+
+	// the reached points, counted into buckets by T
+	for( index=0 ; index < data->size ; index++ )
+		if( !InDomain(data, index) && data->Tfield[index] < Inf )
+			Tmax = max(Tmax, data->Tfield[index]);
+
+	nbuckets = (int) (Tmax * SWEEP_BUCKETS) + 1;
+	start = (int *) AllocMem(sizeof(int) * (nbuckets + 1));
+	memset(start, 0, sizeof(int) * (nbuckets + 1));
+
+	for( index=0 ; index < data->size ; index++ )
+		if( !InDomain(data, index) && data->Tfield[index] < Inf )
+			start[(int) (data->Tfield[index] * SWEEP_BUCKETS) + 1]++;
+	for( k=0 ; k < nbuckets ; k++ )
+		start[k+1] += start[k];
+
+	items = (HeapItem *) AllocMem(sizeof(HeapItem) * max(start[nbuckets], 1));
+	for( index=0 ; index < data->size ; index++ )
+		if( !InDomain(data, index) && data->Tfield[index] < Inf )
+		{
+			k = (int) (data->Tfield[index] * SWEEP_BUCKETS);
+			items[start[k]].T = data->Tfield[index];
+			items[start[k]].index = PixelRow(data,index) * data->cols + PixelCol(data,index);
+			start[k]++;
+			data->Flag[index] = TO_INPAINT;
+		}
+	// start[k] is the end of bucket k now
+	for( k=nbuckets ; k > 0 ; k-- )
+		start[k] = start[k-1];
+	start[0] = 0;
+
+	#pragma omp parallel for num_threads(nthreads) schedule(dynamic)
+	for( k=0 ; k < nbuckets ; k++ )
+		std::sort(items + start[k], items + start[k+1], Earlier);
+
+	#pragma omp parallel for num_threads(nthreads)
+	for( k=0 ; k < start[nbuckets] ; k++ )
+	{
+		data->ordered_points[3*k]   = items[k].index / data->cols;
+		data->ordered_points[3*k+1] = items[k].index % data->cols;
+		data->ordered_points[3*k+2] = items[k].T;
+	}
+
+	FreeMem(start);
+	FreeMem(items);
+	ReportProgress(data, 0.3);
+}
@@ -65,18 +65,6 @@ extern "C" {
 #define TYPE_C 1
 #define TYPE_D 2
 
-void *AllocMem(size_t n)
-{
-	void *p;
-	p = malloc( n );
-	return p;
-}
-
-void FreeMem(void* p)
-{
-	free(p);
-}
-
 void ErrorMessage(int type)
 {
 #ifdef DEBUG
@@ -177,129 +165,14 @@ void ErrorMessage(int type)
     }
 }
 
-void SetDefaults(Data *data)
+static void GimpProgress(double fraction, void *user_data)
 {
-    data->rows = 1;
-    data->cols = 1;
-    data->channels = 1;
-    data->size = 1;
-    data->Image = NULL;
-    data->MImage = NULL;
-
-
-
-    // default parameters
-    data->epsilon = 5;
-    data->radius = 5;
-    data->kappa = 25;
-    data->sigma = 1.414213562373095; // sqrt(2.0);
-    data->rho = 5;
-    data->thresh = 0;
-    data->delta_quant4 = 1; // default quantization range is [0,255]
-
-    data->convex = NULL;
-
-
-    data->ordered_points = NULL;
-    data->nof_points2inpaint = 0;
-    data->heap = NULL;
-    data->Tfield = NULL;
-    data->Domain = NULL;
-    data->MDomain = NULL;
-    data->GivenGuidanceT = NULL;
-
-    data->lenSK1 = 0;
-    data->lenSK2 = 0;
-    data->SKernel1 = NULL;
-    data->SKernel2 = NULL;
-    data->Ihelp = NULL;
-    data->Shelp = NULL;
-
-    data->ordergiven = 0;
-    data->guidance = 1;
-
-    data->inpaint_undefined = 0;
+	gimp_progress_update(fraction);
 }
 
-void ClearMemory(Data *data)
+static void GimpMessage(const char *message, void *user_data)
 {
-	if( data->Image != NULL )
-	{
-		FreeMem( data->Image );
-		data->Image = NULL;
-	}
-
-	if( data->MImage != NULL )
-	{
-		FreeMem( data->MImage );
-		data->MImage = NULL;
-	}
-
-    if( data->Domain != NULL )
-    {
-        FreeMem( data->Domain );
-        data->Domain = NULL;
-    }
-
-    if( data->MDomain != NULL )
-    {
-        FreeMem( data->MDomain );
-        data->MDomain = NULL;
-    }
-
-    if( data->Tfield != NULL )
-    {
-        FreeMem( data->Tfield );
-        data->Tfield = NULL;
-    }
-
-    if( data->heap != NULL )
-    {
-        FreeMem( data->heap );
-        data->heap = NULL;
-    }
-
-    if( data->Ihelp != NULL )
-    {
-        FreeMem( data->Ihelp );
-        data->Ihelp = NULL;
-    }
-
-    if( data->convex != NULL )
-    {
-        FreeMem( data->convex );
-        data->convex = NULL;
-    }
-
-    if( data->SKernel1 != NULL )
-    {
-        FreeMem( data->SKernel1 );
-        data->SKernel1 = NULL;
-    }
-
-    if( data->SKernel2 != NULL )
-    {
-        FreeMem( data->SKernel2 );
-        data->SKernel2 = NULL;
-    }
-
-    if( data->Shelp != NULL )
-    {
-        FreeMem( data->Shelp );
-        data->Shelp = NULL;
-    }
-
-    if( data->ordered_points != NULL )
-    {
-        FreeMem( data->ordered_points );
-        data->ordered_points = NULL;
-    }
-
-    if( data->inpaint_index != NULL )
-    {
-    	FreeMem( data->inpaint_index );
-    	data->inpaint_index = NULL;
-    }
+	g_message("%s", message);
 }
 
 void display_preview(Data *data) {
@@ -339,10 +212,10 @@ void display_preview(Data *data) {
 	guchar* buffer = g_new (guchar, data->cols*data->rows*2);
 	for( int j = 0; j < data->cols ; j++) {
 		for( int i = 0; i < data->rows ; i++) {
-			const int index = j*data->rows + i;
+			const int index = PixelIndex(data,i,j);
 			const int bindex = i*data->cols + j;
-			buffer[bindex*2] = data->Tfield[index].T;
-			buffer[bindex*2+1] = (data->Domain[index]==0)*255;
+			buffer[bindex*2] = data->Tfield[index];
+			buffer[bindex*2+1] = (!InDomain(data,index))*255;
 		}
 	}
 
@@ -375,12 +248,7 @@ int SetImageAndMask(GimpDrawable *image, GimpDrawable *mask, Data *data) {
 	for( int y = data->ymin, i=0 ; y < data->ymax ; y++, i++) {
 		if (i%10==0) gimp_progress_update(0.9+0.1*(gdouble)i/(gdouble)(data->ymax-data->ymin));
 
-		for(int c = 0 ; c < data->channels ; c++) {
-			for(int j=0 , k=0 ; j < data->cols ; j++ , k+=image_channels) {
-				int index = c*data->size + j*data->rows + i;
-				pixel_out[k + c] = (guchar) (data->Image[index]);
-			}
-		}
+		GetImageRow(data,i,pixel_out,image_channels);
 		gimp_pixel_rgn_set_row(&region_out,pixel_out,data->xmin,y,data->cols);
 	}
 
@@ -426,19 +294,12 @@ int GetImageAndMask( GimpDrawable *image, GimpDrawable *mask, Data *data)
 
     //g_message("xmin %d xmax %d ymin %d ymax %d n_extrachannels %d maskaddress %d drawad %d",data->xmin,data->xmax,data->ymin,data->ymax,data->channels,mask->drawable_id,image->drawable_id);
 
-    data->Image = (double *)AllocMem(sizeof(double) * data->size * data->channels);
-    data->MImage = (double *)AllocMem(sizeof(double) * data->size * data->channels);
-
-    data->Ihelp = (double *)AllocMem(sizeof(double) * data->channels);
-    data->Tfield = (hItem *) AllocMem(sizeof(hItem) * data->size);
-    data->Domain = (double *) AllocMem(sizeof(double) * data->size);
-    data->MDomain = (double *) AllocMem(sizeof(double) * data->size);
-    data->heap = (hItem **) AllocMem(sizeof(hItem *) * data->size);
-    data->ordered_points = (double *) AllocMem(sizeof(double) * data->size *3);
-    data->inpaint_index = (int *) AllocMem(sizeof(int) * data->size);
-
-
-    data->nof_points2inpaint = 0;
+    // without a stop path the components of the mask are inpainted in Data
+    // of their own, the whole box only needs image and domain
+    if( data->ordergiven )
+        AllocBuffers(data);
+    else
+        AllocImage(data);
 
 
     GimpPixelRgn region;				// region of interest in drawable, read only
@@ -457,32 +318,7 @@ int GetImageAndMask( GimpDrawable *image, GimpDrawable *mask, Data *data)
     	gimp_pixel_rgn_get_row(&region,pixel,data->xmin,y,data->cols);
     	gimp_pixel_rgn_get_row(&mregion,mpixel,data->xmin,y,data->cols);
 
-    	for(gint c = 0 ; c < data->channels ; c++) {
-    		for( int j=0, k=0, l=0 ; j < data->cols ; j++ , k+=image_channels, l+=mask_channels) {
-    			index = j * data->rows + i;
-    			if( mpixel[l] ) {//INSIDE
-    				if( c == 0 ) {
-    					data->ordered_points[data->nof_points2inpaint*3] = i;
-    					data->ordered_points[data->nof_points2inpaint*3+1] = j;
-    					data->ordered_points[data->nof_points2inpaint*3+2] = -1;
-    					data->inpaint_index[index] = data->nof_points2inpaint;
-    					data->nof_points2inpaint = data->nof_points2inpaint + 1;
-    					data->Domain[index] = 0;
-    					data->MDomain[index] = 0;
-    				}
-    				data->Image[index+c*data->size] = 0;
-					data->MImage[index+c*data->size] = 0;
-    			} else {// OUTSIDE
-    				if( c == 0 ) {
-    					data->Domain[index] = 1;
-    					data->MDomain[index] = 1;
-    				}
-    				data->Image[index+c*data->size] = (double) (pixel[c + k]);
-					data->MImage[index+c*data->size] = data->Image[index+c*data->size];
-
-    			}
-    		}
-    	}
+    	SetImageRow(data,i,pixel,image_channels,mpixel,mask_channels);
     }
 
 
@@ -506,21 +342,17 @@ int CalculateOrderFromPath( gint32 vectors_id, Data *data) {
 
 	for( int j = 0; j < data->cols ; j++) {
 		for( int i = 0; i < data->rows ; i++) {
-			int index = j*data->rows + i;
-			if (data->Domain[index] == 1) {
+			int index = PixelIndex(data,i,j);
+			if (InDomain(data,index)) {
 				//outside
-				data->Tfield[index].T = -1;
-				data->Tfield[index].flag = KNOWN;
-				data->Tfield[index].hpos = -1;
-				data->Tfield[index].i = i;
-				data->Tfield[index].j = j;
+				data->Tfield[index] = -1;
+				data->Flag[index] = KNOWN;
+				data->hpos[index] = -1;
 			} else {
 				//inside
-				data->Tfield[index].T = -1;
-				data->Tfield[index].flag = TO_INPAINT;
-				data->Tfield[index].hpos = -1;
-				data->Tfield[index].i = i;
-				data->Tfield[index].j = j;
+				data->Tfield[index] = -1;
+				data->Flag[index] = TO_INPAINT;
+				data->hpos[index] = -1;
 			}
 		}
 	}
@@ -559,9 +391,9 @@ int CalculateOrderFromPath( gint32 vectors_id, Data *data) {
 
 
 				if (x >= 0 && y >= 0 && x < data->cols && y < data->rows) {
-					const int index = x*data->rows + y;
-					if (data->Domain[index] != 0) return ERR_PATH_OUTSIDE_MASK;
-					data->Tfield[index].T = 255;
+					const int index = PixelIndex(data,y,x);
+					if (InDomain(data,index)) return ERR_PATH_OUTSIDE_MASK;
+					data->Tfield[index] = 255;
 					if (i>0) {
 						gdouble len = sqrt((gdouble)(x-oldx)*(x-oldx) + (gdouble)(y-oldy)*(y-oldy));
 						if (len > 1) {
@@ -570,7 +402,7 @@ int CalculateOrderFromPath( gint32 vectors_id, Data *data) {
 							for (j = 0; j < floor(len); ++j) {
 								gint xtmp = ROUND(oldx + xcoeff*j);
 								gint ytmp = ROUND(oldy + ycoeff*j);
-								data->Tfield[xtmp*data->rows + ytmp].T = 255;
+								data->Tfield[PixelIndex(data,ytmp,xtmp)] = 255;
 							}
 						}
 					}
@@ -588,8 +420,8 @@ int CalculateOrderFromPath( gint32 vectors_id, Data *data) {
 	int n = 0;
 	int *bindex_lookup = (int *) AllocMem(sizeof(int) * data->nof_points2inpaint);
 	for (int i = 0,j = 0; j < data->nof_points2inpaint; i+=3,j++) {
-		int index = data->ordered_points[i+1] * data->rows + data->ordered_points[i];
-		if (data->Tfield[index].T == -1) {
+		int index = PixelIndex(data,data->ordered_points[i],data->ordered_points[i+1]);
+		if (data->Tfield[index] == -1) {
 			bindex_lookup[j] = n;
 			n++;
 		} else {
@@ -613,21 +445,21 @@ int CalculateOrderFromPath( gint32 vectors_id, Data *data) {
 
 	int bindex = 0;
 	for (int i = 0,j = 0; j < data->nof_points2inpaint; i+=3,j++) {
-		int index = data->ordered_points[i+1] * data->rows + data->ordered_points[i];
-		if (data->Tfield[index].T == -1) {
+		int index = PixelIndex(data,data->ordered_points[i],data->ordered_points[i+1]);
+		if (data->Tfield[index] == -1) {
 			int nindex_list[4];
-			nindex_list[0] = index - data->rows;
-			nindex_list[1] = index - 1;
-			nindex_list[2] = index + 1;
-			nindex_list[3] = index + data->rows;
+			nindex_list[0] = index - data->jstride;
+			nindex_list[1] = index - data->istride;
+			nindex_list[2] = index + data->istride;
+			nindex_list[3] = index + data->jstride;
 			for (int n = 0; n < 4; ++n) {
 				int nindex = nindex_list[n];
-				if (data->Domain[nindex]==1) {
+				if (InDomain(data,nindex)) {
 					//neighbour is outside domain
 					//b[bindex]--;
-				} else if (data->Tfield[nindex].T != -1) {
+				} else if (data->Tfield[nindex] != -1) {
 					//neighbour is on stop path
-					b[bindex] -= data->Tfield[nindex].T;
+					b[bindex] -= data->Tfield[nindex];
 				} else {
 					tripletList.push_back(T(bindex,bindex_lookup[data->inpaint_index[nindex]],1));
 					//A.insert(bindex, bindex_lookup[data->inpaint_index[nindex]]) = 1;
@@ -663,11 +495,11 @@ int CalculateOrderFromPath( gint32 vectors_id, Data *data) {
 
 	//put result back in Tfield and ordered_points
 	for (int i = 0,j = 0; j < data->nof_points2inpaint; i+=3,j++) {
-        int index = data->ordered_points[i+1] * data->rows + data->ordered_points[i];
-        if (data->Tfield[index].T == -1) {
-        	data->Tfield[index].T = x[bindex_lookup[j]];
+        int index = PixelIndex(data,data->ordered_points[i],data->ordered_points[i+1]);
+        if (data->Tfield[index] == -1) {
+        	data->Tfield[index] = x[bindex_lookup[j]];
         }
-        data->ordered_points[i+2] = data->Tfield[index].T;
+        data->ordered_points[i+2] = data->Tfield[index];
 	}
 
 	//sort points
@@ -765,33 +597,6 @@ int CalculateOrderFromPath( gint32 vectors_id, Data *data) {
 //    return err;
 //}
 
-void SetKernels(Data *data)
-{
-    int i;
-	int s;
-	int r;
-
-	s = std::max( int(round(2 * data->sigma)) , 1 );
-	r = std::max( int(round(2 * data->rho)) , 1 );
-	data->lenSK1 = 2*s +1;
-	data->lenSK2 = 2*r +1;
-
-
-    if( data->sigma > 0 )
-    {
-        data->SKernel1 = (double *)AllocMem(sizeof(double) * data->lenSK1);
-        for( i=0 ; i < data->lenSK1 ; i++)
-            data->SKernel1[i] = exp( -((i-s)*(i-s))/(2* data->sigma * data->sigma) );
-
-        data->Shelp = (double *) AllocMem(sizeof(double) * data->lenSK1);
-    }
-
-    data->SKernel2 = (double *)AllocMem(sizeof(double) * data->lenSK2);
-    for( i=0 ; i < data->lenSK2 ; i++)
-        data->SKernel2[i] = exp( -((i-r)*(i-r))/(2* data->rho * data->rho) );
-
-}
-
 int CheckForValidInputs(PlugInVals* vals) {
 	bool error = 0;
 	if (!gimp_drawable_is_valid(vals->image_drawable_id)) {
@@ -857,6 +662,9 @@ render (PlugInVals *vals) {
 
 	// set default values
 	SetDefaults(&data);
+	data.layout = LAYOUT_INTERLEAVED; // rows are copied as they come from GIMP
+	data.progress = GimpProgress;
+	data.message = GimpMessage;
 
 	//g_message("xmin %d xmax %d ymin %d ymax %d n_extrachannels %d maskaddress %d drawad %d",xmin,xmax,ymin,ymax,n_extrachannels,mask->drawable_id,drawable->drawable_id);
 
@@ -917,11 +725,11 @@ render (PlugInVals *vals) {
 #ifdef DEBUG
 	g_warning("before GetImageAndMask");
 #endif
+	data.ordergiven = (vals->stop_path_id != -1);
 	err = GetImageAndMask(image,mask,&data);
 #ifdef DEBUG
 	g_warning("after GetImageAndMask");
 #endif
-	data.ordergiven = 0;
 
 	if( err ) {
 		ErrorMessage(err);
@@ -945,7 +753,10 @@ render (PlugInVals *vals) {
 #ifdef DEBUG
 	g_warning("before InpaintImage");
 #endif
-	InpaintImage(&data);
+	if( data.ordergiven )
+		InpaintImage(&data);
+	else
+		InpaintComponents(&data);
 #ifdef DEBUG
 	g_warning("after InpaintImage");
 #endif